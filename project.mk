@@ -41,11 +41,15 @@ endif
 # --- Project config ---
 
 # ASSETS_IGNORED_PATTERNS += atlas.*
+ASSETS_IGNORED_PATTERNS += *.manifest # Texture atlas manifests are only used when regenerating atlases.
+ASSETS_IGNORED_PATTERNS += *.cache # Texture atlas caches are rebuilt on the first run.
 
 _proj_cxxflags += -std=c++2b -pedantic-errors -Wall -Wextra -Wdeprecated -Wextra-semi -Wno-gnu-zero-variadic-macro-arguments
 _proj_cxxflags += -include src/program/common_macros.h -include src/program/parachute.h
 _proj_cxxflags += -Isrc -Ilib/include
 _proj_cxxflags += -Ilib/include/cglfl_gl3.2_core # OpenGL version
+_proj_cxxflags += -pthread
+_proj_ldflags += -pthread # For `std::thread`.
 
 ifeq ($(TARGET_OS),windows)
 _proj_ldflags += $(_proj_win_subsystem)
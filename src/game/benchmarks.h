@@ -0,0 +1,11 @@
+#pragma once
+
+// Micro-benchmarks, run with `--benchmark <name>`. They print the results to `std::cout`.
+namespace Benchmarks
+{
+    // `ghost_timeline`: compares `DeltaTimeline` with a plain `std::vector<Player>` for storing the ghost timelines.
+    void GhostTimeline();
+
+    // `world_snapshot`: measures the size and the save/load time of `States::World` snapshots, compared to constructing a new world.
+    void WorldSnapshot();
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "game/main.h"
+
+// The state of the game controls for the current tick.
+// This doesn't read the input by itself, it's filled by a `ControlsSource` once per tick.
+struct Controls
+{
+    struct Button
+    {
+        MEMBERS(
+            DECL(bool INIT = false) is_down, is_pressed, is_released
+        )
+
+        [[nodiscard]] bool down() const {return is_down;}
+        [[nodiscard]] bool pressed() const {return is_pressed;}
+        [[nodiscard]] bool released() const {return is_released;}
+
+        // Sets the new state, and computes `pressed` and `released` by comparing it with the previous one.
+        void Update(bool new_down)
+        {
+            is_pressed = new_down && !is_down;
+            is_released = !new_down && is_down;
+            is_down = new_down;
+        }
+    };
+
+    MEMBERS(
+        DECL(Button) left, right, jump, shoot, timeshift
+    )
+
+    // Calls `func(Button &button)` for every button, in a fixed order. The const overload passes `const Button &`.
+    template <typename F>
+    void ForEachButton(F &&func)
+    {
+        func(left);
+        func(right);
+        func(jump);
+        func(shoot);
+        func(timeshift);
+    }
+    template <typename F>
+    void ForEachButton(F &&func) const
+    {
+        func(left);
+        func(right);
+        func(jump);
+        func(shoot);
+        func(timeshift);
+    }
+};
+
+// Fills `Controls` once per tick.
+class ControlsSource
+{
+  public:
+    virtual ~ControlsSource() = default;
+
+    virtual void Update(Controls &con) = 0;
+};
+
+// Reads the keyboard.
+class KeyboardControls : public ControlsSource
+{
+    struct Binding
+    {
+        std::vector<Input::Button> buttons;
+
+        [[nodiscard]] bool down() const
+        {
+            for (const Input::Button &button : buttons)
+                if (button.down())
+                    return true;
+            return false;
+        }
+
+        [[nodiscard]] bool pressed() const
+        {
+            bool ok = false;
+            for (const Input::Button &button : buttons)
+            {
+                if (button.down() && !button.pressed())
+                    return false;
+                if (button.pressed())
+                    ok = true;
+            }
+            return ok;
+        }
+
+        [[nodiscard]] bool released() const
+        {
+            bool ok = false;
+            for (const Input::Button &button : buttons)
+            {
+                if (button.down())
+                    return false;
+                if (button.released())
+                    ok = true;
+            }
+            return ok;
+        }
+
+        void Apply(Controls::Button &target) const
+        {
+            target.is_down = down();
+            target.is_pressed = pressed();
+            target.is_released = released();
+        }
+    };
+
+    Binding left = {{Input::left, Input::a}};
+    Binding right = {{Input::right, Input::d}};
+    Binding jump = {{Input::space, Input::c, Input::j, Input::up, Input::w}};
+    Binding shoot = {{Input::x, Input::k}};
+    Binding timeshift = {{Input::z, Input::l}};
+
+  public:
+    void Update(Controls &con) override
+    {
+        left.Apply(con.left);
+        right.Apply(con.right);
+        jump.Apply(con.jump);
+        shoot.Apply(con.shoot);
+        timeshift.Apply(con.timeshift);
+    }
+};
+
+// Presses random buttons, deterministically for a given seed. Used in the headless mode.
+class RandomControls : public ControlsSource
+{
+    Random::DefaultGenerator generator;
+
+    struct ButtonTimer
+    {
+        // How long the button is held and released, in ticks.
+        int min_down = 0, max_down = 0;
+        int min_up = 0, max_up = 0;
+
+        int ticks_left = 0;
+    };
+
+    // Same order as in `Controls::ForEachButton()`.
+    ButtonTimer timers[5] = {
+        {10, 90, 30, 120}, // left
+        {10, 90, 30, 120}, // right
+        {2, 40, 5, 90}, // jump
+        {1, 5, 30, 300}, // shoot
+        {20, 200, 300, 1200}, // timeshift
+    };
+
+  public:
+    RandomControls(unsigned int seed) : generator(seed) {}
+
+    void Update(Controls &con) override
+    {
+        int index = 0;
+        con.ForEachButton([&](Controls::Button &button)
+        {
+            ButtonTimer &timer = timers[index++];
+            if (timer.ticks_left-- > 0)
+            {
+                button.Update(button.down());
+                return;
+            }
+
+            bool new_down = !button.down();
+            button.Update(new_down);
+            timer.ticks_left = std::uniform_int_distribution<int>(new_down ? timer.min_down : timer.min_up, new_down ? timer.max_down : timer.max_up)(generator);
+        });
+    }
+};
+
+// Where `States::World` reads the controls from.
+extern std::unique_ptr<ControlsSource> controls_source;
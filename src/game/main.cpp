@@ -1,5 +1,9 @@
 #include "main.h"
 
+#include "game/benchmarks.h"
+#include "game/controls.h"
+#include "game/replay.h"
+
 constexpr bool is_debug =
 #ifdef NDEBUG
     false;
@@ -12,50 +16,111 @@ constexpr auto fullscreen_flavor = Interface::borderless_fullscreen;
 
 const std::string_view window_name = "Flameline";
 
-Interface::Window window(std::string(window_name), screen_size * 2, Interface::windowed, adjust_(Interface::WindowSettings{}, min_size = screen_size));
-static Graphics::DummyVertexArray dummy_vao = nullptr;
+// The window, graphics and audio are created by `InitWindowAndAudio()`. They remain null in the headless mode.
+
+Interface::Window window;
+static Graphics::DummyVertexArray dummy_vao;
 
-Audio::Context audio_context = nullptr;
+Audio::Context audio_context;
 Audio::SourceManager audio_controller;
 
 const Graphics::ShaderConfig shader_config = Graphics::ShaderConfig::Core();
 
-Graphics::FontFile Fonts::Files::main(Program::ExeDir() + "assets/Monocat_7x14.ttf", 14);
+Graphics::FontFile Fonts::Files::main;
 Graphics::Font Fonts::main;
+Graphics::GlyphCache Fonts::main_cache;
 
-Graphics::TextureAtlas texture_atlas = []{
-    std::string atlas_loc = is_debug ? "assets/assets/" : Program::ExeDir() + "assets/";
-    Graphics::TextureAtlas ret(ivec2(2048), is_debug ? "assets/_images" : "", atlas_loc + "atlas.png", atlas_loc + "atlas.refl", {{"/font_storage", ivec2(256)}});
-    auto font_region = ret.Get("/font_storage");
-
-    Unicode::CharSet glyph_ranges;
-    glyph_ranges.Add(Unicode::Ranges::Basic_Latin);
+Graphics::TextureAtlas texture_atlas;
 
-    Graphics::MakeFontAtlas(ret.GetImage(), font_region.pos, font_region.size, {
-        {Fonts::main, Fonts::Files::main, glyph_ranges, Graphics::FontFile::monochrome_with_hinting},
-    });
-    return ret;
-}();
-Graphics::Texture texture_main = Graphics::Texture(nullptr).Wrap(Graphics::clamp).Interpolation(Graphics::nearest).SetData(texture_atlas.GetImage());
+Graphics::Texture texture_main;
 
-GameUtils::AdaptiveViewport adaptive_viewport(shader_config, screen_size);
-Render r = adjust_(Render(0x2000, shader_config), SetTexture(texture_main), SetMatrix(adaptive_viewport.GetDetails().MatrixCentered()));
+GameUtils::AdaptiveViewport adaptive_viewport;
+Render r;
+static Render::Backend render_backend = Render::Backend::triangles; // Set from the command line.
 
 Input::Mouse mouse;
 
 Random::DefaultGenerator random_generator = Random::MakeGeneratorFromRandomDevice();
 Random::DefaultInterfaces<Random::DefaultGenerator> ra(random_generator);
 
+std::unique_ptr<ControlsSource> controls_source = std::make_unique<KeyboardControls>();
+
 namespace Theme
 {
-    Audio::Buffer buf(Audio::Sound(Audio::ogg, Audio::stereo, Program::ExeDir() + "assets/gates_of_heck.ogg"));
-    Audio::Source src = adjust_(Audio::Source(buf), loop(), volume(0.9f), play());
+    Audio::Buffer buf;
+    Audio::Source src;
+}
+
+static void InitWindowAndAudio()
+{
+    window = Interface::Window(std::string(window_name), screen_size * 2, Interface::windowed, adjust_(Interface::WindowSettings{}, min_size = screen_size));
+    dummy_vao = nullptr;
+
+    audio_context = nullptr;
+
+    Fonts::Files::main = Graphics::FontFile(Program::ExeDir() + "assets/Monocat_7x14.ttf", 14);
+
+    texture_atlas = []{
+        std::string atlas_loc = is_debug ? "assets/assets/" : Program::ExeDir() + "assets/";
+        Graphics::TextureAtlas ret(ivec2(2048), is_debug ? "assets/_images" : "", atlas_loc + "atlas.png", atlas_loc + "atlas.refl", {{"/font_storage", ivec2(256)}, {"/font_glyph_cache", ivec2(256)}});
+        auto font_region = ret.Get("/font_storage");
+
+        Unicode::CharSet glyph_ranges;
+        glyph_ranges.Add(Unicode::Ranges::Basic_Latin);
+
+        Graphics::MakeFontAtlas(ret.GetImage(font_region.page), font_region.pos, font_region.size, {
+            {Fonts::main, Fonts::Files::main, glyph_ranges, Graphics::FontFile::monochrome_with_hinting},
+        });
+        return ret;
+    }();
+    // The renderer samples a single texture, so all images must be on the same page.
+    if (texture_atlas.PageCount() != 1)
+        Program::Error("The texture atlas doesn't fit into a single ", texture_atlas.GetImage().Size().x, 'x', texture_atlas.GetImage().Size().y, " page.");
+    Graphics::ResolveMentionedAtlasRegions(texture_atlas);
+    texture_main = Graphics::Texture(nullptr).Wrap(Graphics::clamp).Interpolation(Graphics::nearest).SetData(texture_atlas.GetImage());
+
+    // The glyphs not in `/font_storage` are rasterized on first use.
+    auto glyph_cache_region = texture_atlas.Get("/font_glyph_cache");
+    Fonts::main_cache = Graphics::GlyphCache(Fonts::main, Fonts::Files::main, Graphics::FontFile::monochrome_with_hinting, texture_main, glyph_cache_region.pos, glyph_cache_region.size);
+
+    adaptive_viewport = GameUtils::AdaptiveViewport(shader_config, screen_size);
+    r = adjust_(Render(0x2000, shader_config, render_backend), SetTexture(texture_main), SetMatrix(adaptive_viewport.GetDetails().MatrixCentered()));
+
+    Theme::buf = Audio::Buffer(Audio::Sound(Audio::ogg, Audio::stereo, Program::ExeDir() + "assets/gates_of_heck.ogg"));
+    Theme::src = adjust_(Audio::Source(Theme::buf), loop(), volume(0.9f), play());
+}
+
+// Runs the world simulation without a window and audio, and prints the tick rate.
+// Stops after `ticks` ticks, or when the `replay` ends, whichever comes first.
+// If specified, starts from the snapshot in `load_snapshot_file`, and saves a snapshot to `save_snapshot_file` at the end.
+static void RunHeadless(std::optional<int> ticks, const ReplayControls *replay, const std::optional<std::string> &load_snapshot_file, const std::optional<std::string> &save_snapshot_file)
+{
+    GameUtils::State::Manager<StateBase> state_manager;
+    state_manager.SetState("World{}");
+
+    if (load_snapshot_file)
+        state_manager.Call(&StateBase::LoadSnapshot, Stream::ReadOnlyData(*load_snapshot_file));
+
+    std::uint64_t start = Clock::Time();
+    int ticks_done = 0;
+    while ((!ticks || ticks_done < *ticks) && (!replay || !replay->IsFinished()) && state_manager)
+    {
+        state_manager.Tick();
+        ticks_done++;
+    }
+    double seconds = Clock::TicksToSeconds(Clock::Time() - start);
+
+    std::cout << FMT("Simulated {} ticks in {:.3f} s, {:.0f} ticks/s.\n", ticks_done, seconds, ticks_done / seconds);
+
+    if (save_snapshot_file && state_manager)
+        Stream::SaveFile(*save_snapshot_file, state_manager.Call(&StateBase::SaveSnapshot));
 }
 
 struct Application : Program::DefaultBasicState
 {
     GameUtils::State::Manager<StateBase> state_manager;
     GameUtils::FpsCounter fps_counter;
+    GameUtils::RenderStats render_stats;
 
     void Resize()
     {
@@ -63,6 +128,13 @@ struct Application : Program::DefaultBasicState
         mouse.SetMatrix(adaptive_viewport.GetDetails().MouseMatrixCentered());
     }
 
+    // Waits for the captured frames to be saved before exiting, if the capture is enabled.
+    [[noreturn]] void Exit()
+    {
+        adaptive_viewport.StopCapture();
+        Program::Exit();
+    }
+
     Metronome metronome = Metronome(60);
 
     Metronome *GetTickMetronome() override
@@ -78,8 +150,15 @@ struct Application : Program::DefaultBasicState
     void EndFrame() override
     {
         fps_counter.Update();
+        render_stats.Update();
         if (is_debug)
-            window.SetTitle(STR((window_name), " TPS:", (fps_counter.Tps()), " FPS:", (fps_counter.Fps()), " AUDIO:", (audio_controller.ActiveSources())));
+        {
+            const Graphics::RenderCounters &frame = render_stats.Frame();
+            window.SetTitle(STR((window_name), " TPS:", (fps_counter.Tps()), " FPS:", (fps_counter.Fps()), " AUDIO:", (audio_controller.ActiveSources()),
+                " QUADS:", (frame.quads), " CULLED:", (frame.culled_quads), " TRIS:", (frame.triangles), " VERTS:", (frame.vertices), " KB:", (frame.bytes / 1024), " FLUSHES:", (frame.flushes),
+                " TEX_BINDS:", (frame.texture_binds), " SHADER_BINDS:", (frame.shader_binds), " SYNCS_AVOIDED:", (r.GetQueueStats().syncs_avoided),
+                " ATLAS_PAGES:", (texture_atlas.PageCount()), " ATLAS_USED:", (iround(texture_atlas.PackingEfficiency() * 100)), "%"));
+        }
     }
 
     void Tick() override
@@ -87,7 +166,7 @@ struct Application : Program::DefaultBasicState
         window.ProcessEvents();
 
         if (window.ExitRequested())
-            Program::Exit();
+            Exit();
         if (window.Resized())
         {
             Resize();
@@ -100,7 +179,7 @@ struct Application : Program::DefaultBasicState
         Audio::CheckErrors();
 
         if (!state_manager)
-            Program::Exit();
+            Exit();
 
         // Toggle fullscreen.
         if ((Input::Button(Input::l_alt).down() || Input::Button(Input::r_alt).down()) && Input::Button(Input::enter).pressed())
@@ -127,6 +206,8 @@ struct Application : Program::DefaultBasicState
         Graphics::CheckErrors();
 
         window.SwapBuffers();
+
+        Fonts::main_cache.NextFrame();
     }
 
 
@@ -151,11 +232,123 @@ struct Application : Program::DefaultBasicState
     }
 };
 
-IMP_MAIN(,)
+IMP_MAIN(argc, argv)
 {
+    bool headless = false;
+    std::optional<int> headless_ticks;
+    std::optional<std::uint32_t> seed;
+    std::optional<std::string> record_file, replay_file;
+    std::optional<std::string> load_snapshot_file, save_snapshot_file;
+    std::optional<std::string> capture_prefix;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--benchmark" && i + 1 < argc)
+        {
+            std::string_view name = argv[++i];
+            if (name == "ghost_timeline")
+                Benchmarks::GhostTimeline();
+            else if (name == "world_snapshot")
+                Benchmarks::WorldSnapshot();
+            else
+                Program::Error("Unknown benchmark: `", name, "`.");
+            return 0;
+        }
+        else if (arg == "--instanced-render")
+        {
+            render_backend = Render::Backend::instanced;
+        }
+        else if (arg == "--headless")
+        {
+            headless = true;
+        }
+        else if (arg == "--ticks" && i + 1 < argc)
+        {
+            headless_ticks = Strings::FromString<int>(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = Strings::FromString<std::uint32_t>(argv[++i]);
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            record_file = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replay_file = argv[++i];
+        }
+        else if (arg == "--load-snapshot" && i + 1 < argc)
+        {
+            load_snapshot_file = argv[++i];
+        }
+        else if (arg == "--save-snapshot" && i + 1 < argc)
+        {
+            save_snapshot_file = argv[++i];
+        }
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            capture_prefix = argv[++i];
+        }
+        else
+        {
+            Program::Error("Unknown command line argument: `", arg, "`.");
+        }
+    }
+
+    if (!headless && (load_snapshot_file || save_snapshot_file))
+        Program::Error("`--load-snapshot` and `--save-snapshot` require `--headless`.");
+    if (headless && capture_prefix)
+        Program::Error("`--capture` can't be used with `--headless`, since nothing is rendered.");
+    if (!headless && headless_ticks)
+        Program::Error("`--ticks` requires `--headless`.");
+
+    const ReplayControls *replay = nullptr;
+
+    { // Set up the controls and the random seed.
+        if (replay_file)
+        {
+            auto replay_source = std::make_unique<ReplayControls>(*replay_file);
+            replay = replay_source.get();
+            seed = replay->Seed();
+            controls_source = std::move(replay_source);
+        }
+        else if (headless)
+        {
+            seed = seed.value_or(0);
+            controls_source = std::make_unique<RandomControls>(*seed);
+        }
+
+        if (record_file)
+        {
+            // The replay needs a known seed.
+            if (!seed)
+                seed = std::random_device{}();
+            controls_source = std::make_unique<RecordingControls>(std::move(controls_source), *record_file, *seed);
+        }
+
+        if (seed)
+            random_generator.seed(*seed);
+    }
+
+    if (headless)
+    {
+        if (!headless_ticks && !replay_file)
+            headless_ticks = 60 * 60;
+        RunHeadless(headless_ticks, replay, load_snapshot_file, save_snapshot_file);
+        return 0;
+    }
+
+    InitWindowAndAudio();
+
+    if (capture_prefix)
+        adaptive_viewport.StartCapture(*capture_prefix);
+
     Application app;
     app.Init();
     app.Resize();
     app.RunMainLoop();
+    adaptive_viewport.StopCapture(); // Throws if some frames couldn't be saved.
     return 0;
 }
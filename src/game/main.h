@@ -18,6 +18,7 @@ namespace Fonts
     }
 
     extern Graphics::Font main;
+    extern Graphics::GlyphCache main_cache; // Rasterizes glyphs of `main` that aren't in the atlas on demand.
 }
 
 extern Graphics::TextureAtlas texture_atlas;
@@ -35,4 +36,15 @@ extern Random::DefaultInterfaces<Random::DefaultGenerator> ra;
 STRUCT( StateBase EXTENDS GameUtils::State::Base POLYMORPHIC )
 {
     virtual void Render() const = 0;
+
+    // Binary snapshots of the whole state. Not every state supports them.
+    [[nodiscard]] virtual std::vector<unsigned char> SaveSnapshot() const
+    {
+        Program::Error("This state doesn't support snapshots.");
+    }
+    virtual void LoadSnapshot(Stream::ReadOnlyData snapshot)
+    {
+        (void)snapshot;
+        Program::Error("This state doesn't support snapshots.");
+    }
 };
@@ -8,7 +8,7 @@ Map::Map(Stream::ReadOnlyData data)
     auto tiles = Tiled::LoadTileLayer(Tiled::FindLayer(json.GetView(), "mid"));
 
     cells = Array2D<Cell>(tiles.size());
-    random = Array2D<unsigned char>(tiles.size());
+    RebuildTileData();
 
     for (auto pos : vector_range(cells.size()))
     {
@@ -16,12 +16,11 @@ Map::Map(Stream::ReadOnlyData data)
         if (tile < Tile{} || tile >= Tile::_count)
             throw std::runtime_error(FMT("Invalid tile index {} at {}.", int(tile), pos));
 
-        Cell &cell = cells.unsafe_at(pos);
-        cell.tile = tile;
-
-        random.unsafe_at(pos) = ra.i <= 255;
+        SetTile(pos, tile);
     }
 
+    RandomizeTileVariants();
+
     points = Tiled::LoadPointLayer(Tiled::FindLayer(json.GetView(), "points"));
 
     player_start = points.GetSinglePoint("player");
@@ -46,46 +45,86 @@ Map::Map(Stream::ReadOnlyData data)
     num_secrets = int(secrets.size());
 }
 
-void Map::render(ivec2 camera_pos) const
+void Map::SetTile(ivec2 pos, Tile tile)
 {
-    static const auto &region = texture_atlas.Get("tiles.png");
+    Cell &cell = cells.safe_throwing_at(pos);
+    cell.tile = tile;
+
+    const TileInfo &info = cell.info();
+    solid_tiles.Set(pos, info.solid);
+    killing_tiles.Set(pos, info.kills);
+    breakable_tiles.Set(pos, info.breakable);
+
+    // The neighbors are affected too, because of the spike merging and the dual grid.
+    ivec2 dirty_a = pos - 1;
+    ivec2 dirty_b = pos + 1;
+    // The tiles outside of the map are clamped to the border, so changing a border tile affects them too.
+    for (int i = 0; i < 2; i++)
+    {
+        if (pos[i] == 0)
+            dirty_a[i] = -TileMeshCache::chunk_size;
+        if (pos[i] == size()[i] - 1)
+            dirty_b[i] = size()[i] - 1 + TileMeshCache::chunk_size;
+    }
+    mesh_cache.MarkDirty(dirty_a, dirty_b);
+}
 
-    ivec2 corner_a = div_ex(camera_pos - screen_size / 2, tile_size);
-    ivec2 corner_b = div_ex(camera_pos + screen_size / 2, tile_size);
+void Map::RandomizeTileVariants()
+{
+    random = Array2D<unsigned char>(size());
+    for (auto pos : vector_range(size()))
+        random.unsafe_at(pos) = ra.i <= 255;
+    mesh_cache = {}; // The meshes could depend on it.
+}
 
-    { // Bottom layer.
-        for (ivec2 tile_pos : corner_a <= vector_range <= corner_b)
-        {
-            const Cell &cell = at(tile_pos);
-            const TileInfo &info = cell.info();
-            if (info.spike_like_dir != -1)
-            {
-                int sign = info.spike_like_dir == 1 ? -1 : 1;
-
-                ivec2 dir = ivec2::dir4(info.spike_like_dir);
-                fmat2 mat(dir, dir.rot90());
-                ivec2 offset_a = ivec2(-1 * sign, 0).rot90(info.spike_like_dir);
-                ivec2 offset_b = ivec2( 1 * sign, 0).rot90(info.spike_like_dir);
-                const Cell &cell_a = at(tile_pos + offset_a);
-                const Cell &cell_b = at(tile_pos + offset_b);
-                bool same_a = cell_a.tile == cell.tile || (info.spike_like_merge_with_any_solid && cell_a.info().solid);
-                bool same_b = cell_b.tile == cell.tile || (info.spike_like_merge_with_any_solid && cell_b.info().solid);
-
-                ivec2 pixel_pos = tile_pos * tile_size + tile_size/2 - camera_pos;
-                r.iquad(pixel_pos, region.region(ivec2(0, tile_size * (info.spike_like_tex + same_a)), ivec2(tile_size) with(x /= 2))).center(ivec2(tile_size/2)).matrix(mat).flip_x(sign < 0);
-                r.iquad(pixel_pos, region.region(ivec2(tile_size/2, tile_size * (info.spike_like_tex + same_b)), ivec2(tile_size) with(x /= 2))).center(ivec2(0, tile_size/2)).matrix(mat).flip_x(sign < 0);
-            }
-        }
-    }
+void Map::RebuildTileData()
+{
+    solid_tiles = TileBitplane(size());
+    killing_tiles = TileBitplane(size());
+    breakable_tiles = TileBitplane(size());
+    mesh_cache = {};
 
-    { // Dual-grid layer.
-        ivec2 dual_corner_a = div_ex(camera_pos - screen_size / 2 - tile_size / 2, tile_size);
-        ivec2 dual_corner_b = div_ex(camera_pos + screen_size / 2 - tile_size / 2, tile_size);
+    for (auto pos : vector_range(size()))
+        SetTile(pos, cells.unsafe_at(pos).tile);
+}
 
+void Map::RenderLayer(TileMeshCache::Layer layer, ivec2 a, ivec2 b, ivec2 offset) const
+{
+    const auto &region = Graphics::AtlasRegion<"tiles.png">();
 
-        for (ivec2 tile_pos : dual_corner_a <= vector_range <= dual_corner_b)
-        {
-            { // Dual grid.
+    std::vector<Render::Sprite> &sprites = r.SpriteBuffer();
+
+    switch (layer)
+    {
+        case TileMeshCache::layer_bottom:
+            for (ivec2 tile_pos : a <= vector_range <= b)
+            {
+                const Cell &cell = at(tile_pos);
+                const TileInfo &info = cell.info();
+                if (info.spike_like_dir != -1)
+                {
+                    int sign = info.spike_like_dir == 1 ? -1 : 1;
+
+                    ivec2 dir = ivec2::dir4(info.spike_like_dir);
+                    fmat2 mat(dir, dir.rot90());
+                    ivec2 offset_a = ivec2(-1 * sign, 0).rot90(info.spike_like_dir);
+                    ivec2 offset_b = ivec2( 1 * sign, 0).rot90(info.spike_like_dir);
+                    const Cell &cell_a = at(tile_pos + offset_a);
+                    const Cell &cell_b = at(tile_pos + offset_b);
+                    bool same_a = cell_a.tile == cell.tile || (info.spike_like_merge_with_any_solid && cell_a.info().solid);
+                    bool same_b = cell_b.tile == cell.tile || (info.spike_like_merge_with_any_solid && cell_b.info().solid);
+
+                    ivec2 pixel_pos = tile_pos * tile_size + tile_size/2 + offset;
+                    r.iquad(pixel_pos, region.region(ivec2(0, tile_size * (info.spike_like_tex + same_a)), ivec2(tile_size) with(x /= 2))).center(ivec2(tile_size/2)).matrix(mat).flip_x(sign < 0);
+                    r.iquad(pixel_pos, region.region(ivec2(tile_size/2, tile_size * (info.spike_like_tex + same_b)), ivec2(tile_size) with(x /= 2))).center(ivec2(0, tile_size/2)).matrix(mat).flip_x(sign < 0);
+                }
+            }
+            break;
+
+        case TileMeshCache::layer_dual_grid:
+            sprites.clear();
+            for (ivec2 tile_pos : a <= vector_range <= b)
+            {
                 int bits = 0;
                 for (ivec2 tile_offset : vector_range(ivec2(2)))
                 {
@@ -101,21 +140,81 @@ void Map::render(ivec2 camera_pos) const
                 //         variant = ivec2(4, randvar);
                 // }
 
-                ivec2 dual_pixel_pos = tile_pos * tile_size + tile_size / 2 - camera_pos;
-                r.iquad(dual_pixel_pos, region.region((variant + ivec2(1, 0)) * tile_size, ivec2(tile_size)));
+                ivec2 dual_pixel_pos = tile_pos * tile_size + tile_size / 2 + offset;
+                Render::Sprite &sprite = sprites.emplace_back();
+                sprite.pos = dual_pixel_pos;
+                sprite.size = ivec2(tile_size);
+                sprite.tex_pos = region.pos + (variant + ivec2(1, 0)) * tile_size;
+                sprite.has_texture = true;
+            }
+            r.DrawSprites(sprites);
+            break;
+
+        case TileMeshCache::layer_top:
+            sprites.clear();
+            for (ivec2 tile_pos : a <= vector_range <= b)
+            {
+                const Cell &cell = at(tile_pos);
+                const TileInfo &info = cell.info();
+                if (info.simple_tex != -1)
+                {
+                    Render::Sprite &sprite = sprites.emplace_back();
+                    sprite.pos = tile_pos * tile_size + offset;
+                    sprite.size = ivec2(tile_size);
+                    sprite.tex_pos = region.pos + ivec2(0, tile_size * info.simple_tex);
+                    sprite.has_texture = true;
+                }
             }
+            r.DrawSprites(sprites);
+            break;
+
+        case TileMeshCache::_layer_count:
+            break;
+    }
+}
+
+void Map::render(ivec2 camera_pos) const
+{
+    constexpr int chunk_size = TileMeshCache::chunk_size;
+
+    if (mesh_cache.chunks.element_count() == 0)
+    {
+        // Leave a margin of one chunk around the map, because the tiles outside of it are visible too (they're clamped to the border).
+        mesh_cache.first_chunk = ivec2(-1);
+        mesh_cache.chunks = Array2D<TileMeshCache::Chunk>(div_ex(size() - 1, chunk_size) + 2 - mesh_cache.first_chunk);
+    }
+
+    // This covers both the visible tiles and the visible dual-grid cells.
+    ivec2 corner_a = div_ex(camera_pos - screen_size / 2 - tile_size / 2, tile_size);
+    ivec2 corner_b = div_ex(camera_pos + screen_size / 2, tile_size);
+    ivec2 chunk_a = div_ex(corner_a, chunk_size);
+    ivec2 chunk_b = div_ex(corner_b, chunk_size);
+
+    // Rebuild the visible dirty chunks.
+    for (ivec2 chunk_pos : chunk_a <= vector_range <= chunk_b)
+    {
+        TileMeshCache::Chunk *chunk = mesh_cache.GetChunk(chunk_pos);
+        if (!chunk || !chunk->dirty)
+            continue;
+
+        for (int layer = 0; layer < TileMeshCache::_layer_count; layer++)
+        {
+            r.BeginMesh(chunk->meshes[layer]);
+            RenderLayer(TileMeshCache::Layer(layer), chunk_pos * chunk_size, chunk_pos * chunk_size + chunk_size - 1, ivec2(0));
+            r.EndMesh();
         }
+        chunk->dirty = false;
     }
 
-    { // Top layer.
-        for (ivec2 tile_pos : corner_a <= vector_range <= corner_b)
+    // Draw the layers in order, one draw call per chunk per layer.
+    for (int layer = 0; layer < TileMeshCache::_layer_count; layer++)
+    {
+        for (ivec2 chunk_pos : chunk_a <= vector_range <= chunk_b)
         {
-            const Cell &cell = at(tile_pos);
-            const TileInfo &info = cell.info();
-            if (info.simple_tex != -1)
-            {
-                r.iquad(tile_pos * tile_size - camera_pos, region.region(ivec2(0, tile_size * info.simple_tex), ivec2(tile_size)));
-            }
+            if (TileMeshCache::Chunk *chunk = mesh_cache.GetChunk(chunk_pos))
+                r.DrawMesh(chunk->meshes[layer], -camera_pos);
+            else
+                RenderLayer(TileMeshCache::Layer(layer), chunk_pos * chunk_size, chunk_pos * chunk_size + chunk_size - 1, -camera_pos); // Too far outside of the map, draw directly.
         }
     }
 }
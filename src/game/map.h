@@ -17,6 +17,7 @@ enum class Tile
     breakable,
     _count,
 };
+ENUM_METADATA( Tile, (air)(wall)(spike_up)(spike_down)(spike_left)(spike_right)(box1)(box2)(chain_h)(chain_v)(breakable) )
 
 struct TileInfo
 {
@@ -60,7 +61,9 @@ static_assert([]{
 
 struct Cell
 {
-    Tile tile{};
+    MEMBERS(
+        DECL(Tile INIT{}) tile
+    )
 
     [[nodiscard]] const TileInfo &info() const
     {
@@ -70,41 +73,177 @@ struct Cell
     }
 };
 
+// One bit per tile, for fast collision checks. Rows are padded to whole words.
+class TileBitplane
+{
+    int row_words = 0;
+    std::vector<std::uint64_t> words;
+
+  public:
+    TileBitplane() {}
+    TileBitplane(ivec2 size) : row_words((size.x + 63) / 64), words(std::size_t(row_words * size.y)) {}
+
+    // The position must be in range.
+    [[nodiscard]] bool Get(ivec2 pos) const
+    {
+        return words[pos.y * row_words + pos.x / 64] >> (pos.x % 64) & 1;
+    }
+
+    // The position must be in range.
+    void Set(ivec2 pos, bool value)
+    {
+        std::uint64_t &word = words[pos.y * row_words + pos.x / 64];
+        std::uint64_t mask = std::uint64_t(1) << (pos.x % 64);
+        if (value)
+            word |= mask;
+        else
+            word &= ~mask;
+    }
+
+    // Returns true if any bit is set in the rectangle from `a` to `b` inclusive. The rectangle must be in range.
+    // This checks 64 tiles of a row at once.
+    [[nodiscard]] bool AnyInRect(ivec2 a, ivec2 b) const
+    {
+        int first_word = a.x / 64;
+        int last_word = b.x / 64;
+        std::uint64_t first_mask = ~std::uint64_t(0) << (a.x % 64);
+        std::uint64_t last_mask = ~std::uint64_t(0) >> (63 - b.x % 64);
+
+        for (int y = a.y; y <= b.y; y++)
+        {
+            const std::uint64_t *row = words.data() + y * row_words;
+            for (int w = first_word; w <= last_word; w++)
+            {
+                std::uint64_t mask = ~std::uint64_t(0);
+                if (w == first_word)
+                    mask &= first_mask;
+                if (w == last_word)
+                    mask &= last_mask;
+                if (row[w] & mask)
+                    return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Caches the tile geometry of `Map` in fixed-size chunks, one mesh per layer per chunk.
+// Copying produces an empty cache, to avoid sharing the vertex buffers.
+class TileMeshCache
+{
+  public:
+    static constexpr int chunk_size = 16; // In tiles.
+
+    enum Layer
+    {
+        layer_bottom,
+        layer_dual_grid,
+        layer_top,
+        _layer_count,
+    };
+
+    struct Chunk
+    {
+        bool dirty = true;
+        Render::Mesh meshes[_layer_count];
+    };
+
+    // Chunk indices range from `first_chunk` inclusive to `first_chunk + chunks.size()` exclusive.
+    ivec2 first_chunk;
+    Array2D<Chunk> chunks;
+
+    TileMeshCache() {}
+    TileMeshCache(const TileMeshCache &) : TileMeshCache() {}
+    TileMeshCache &operator=(const TileMeshCache &)
+    {
+        chunks = {};
+        return *this;
+    }
+
+    // Returns null if the chunk is outside of the cached area.
+    [[nodiscard]] Chunk *GetChunk(ivec2 chunk_pos)
+    {
+        chunk_pos -= first_chunk;
+        if (!chunks.pos_in_range(chunk_pos))
+            return nullptr;
+        return &chunks.unsafe_at(chunk_pos);
+    }
+
+    // Marks all chunks touching the tiles from `a` to `b` inclusive as dirty.
+    void MarkDirty(ivec2 a, ivec2 b)
+    {
+        if (chunks.element_count() == 0)
+            return;
+        ivec2 chunk_a = clamp(div_ex(a, chunk_size) - first_chunk, 0, chunks.size() - 1);
+        ivec2 chunk_b = clamp(div_ex(b, chunk_size) - first_chunk, 0, chunks.size() - 1);
+        for (ivec2 pos : chunk_a <= vector_range <= chunk_b)
+            chunks.unsafe_at(pos).dirty = true;
+    }
+};
+
 struct Map
 {
-    Array2D<Cell> cells;
-    Array2D<unsigned char> random;
+    MEMBERS(
+        // Don't modify the tiles directly, use `SetTile()`.
+        DECL(Array2D<Cell>) cells
+        DECL(Array2D<unsigned char>) random
+
+        DECL(ivec2) player_start
+        DECL(std::optional<ivec2>) debug_player_start
+        DECL(float INIT = 0) initial_lava_level
+        DECL(float INIT = 0) exit_level
 
-    ivec2 player_start;
-    std::optional<ivec2> debug_player_start;
-    float initial_lava_level = 0;
-    float exit_level = 0;
+        DECL(std::optional<ivec2>) ability_timeshift
+        DECL(bool INIT = false) debug_start_with_timeshift
 
-    std::optional<ivec2> ability_timeshift;
-    bool debug_start_with_timeshift = false;
+        DECL(std::optional<ivec2>) ability_doublejump
+        DECL(bool INIT = false) debug_start_with_doublejump
 
-    std::optional<ivec2> ability_doublejump;
-    bool debug_start_with_doublejump = false;
+        DECL(std::optional<ivec2>) ability_gun
+        DECL(bool INIT = false) debug_start_with_gun
 
-    std::optional<ivec2> ability_gun;
-    bool debug_start_with_gun = false;
+        DECL(std::vector<ivec2>) secrets
+        DECL(int INIT = 0) num_secrets
+    )
 
-    std::vector<ivec2> secrets;
-    int num_secrets = 0;
+    // Tile flags from `tile_info`, updated by `SetTile()`. Not serialized, `RebuildTileData()` recomputes them.
+    TileBitplane solid_tiles;
+    TileBitplane killing_tiles;
+    TileBitplane breakable_tiles;
 
+    // Not serialized, since it's only used when constructing the world.
     Tiled::PointLayer points;
 
-    MAYBE_CONST(
-        [[nodiscard]] CV Cell &at(ivec2 pos) CV
-        {
-            return cells.clamped_at(pos);
-        }
+    // Filled lazily by `render()`. Not used in the headless mode, since it needs GL.
+    mutable TileMeshCache mesh_cache;
 
-        [[nodiscard]] CV Cell &at_pixel(ivec2 pixel_pos) CV
-        {
-            return at(div_ex(pixel_pos, tile_size));
-        }
-    )
+    [[nodiscard]] const Cell &at(ivec2 pos) const
+    {
+        return cells.clamped_at(pos);
+    }
+
+    [[nodiscard]] const Cell &at_pixel(ivec2 pixel_pos) const
+    {
+        return at(div_ex(pixel_pos, tile_size));
+    }
+
+    // Changes a tile and updates the bitplanes. Throws if the position is out of range.
+    void SetTile(ivec2 pos, Tile tile);
+
+    // Recomputes the bitplanes and resets the mesh cache, after `cells` were replaced.
+    void RebuildTileData();
+
+    // Fills `random` using the global generator.
+    void RandomizeTileVariants();
+
+    // Returns true if any tile in the rectangle of pixels from `a` to `b` (inclusive) is set in `plane`.
+    // Out-of-range tiles are clamped to the map boundary, like in `at()`.
+    [[nodiscard]] bool AnyInPixelRect(const TileBitplane &plane, ivec2 a, ivec2 b) const
+    {
+        ivec2 tile_a = clamp(div_ex(a, tile_size), 0, size() - 1);
+        ivec2 tile_b = clamp(div_ex(b, tile_size), 0, size() - 1);
+        return plane.AnyInRect(tile_a, tile_b);
+    }
 
     [[nodiscard]] unsigned char rand_at(ivec2 pos) const
     {
@@ -118,5 +257,20 @@ struct Map
 
     Map(Stream::ReadOnlyData data);
 
+    // Those draw a single layer for the tiles in the rectangle from `a` to `b` inclusive.
+    // The dual-grid layer uses dual-grid cell coordinates instead, where a cell `pos` covers the tiles from `pos` to `pos + 1`.
+    void RenderLayer(TileMeshCache::Layer layer, ivec2 a, ivec2 b, ivec2 offset) const;
+
     void render(ivec2 camera_pos) const;
 };
+
+template <>
+struct Refl::StructCallbacks<Map> : Refl::DefaultStructCallbacks<Map>
+{
+    static void PostDeserialize(Map &map)
+    {
+        if (map.random.size() != map.cells.size())
+            throw std::runtime_error("Map tile and random arrays have different sizes.");
+        map.RebuildTileData();
+    }
+};
@@ -15,6 +15,7 @@
 #include "gameutils/adaptive_viewport.h"
 #include "gameutils/fps_counter.h"
 #include "gameutils/render.h"
+#include "gameutils/render_stats.h"
 #include "gameutils/state.h"
 #include "gameutils/tiled_map.h"
 #include "graphics/complete.h"
@@ -1,67 +1,173 @@
 #include "particles.h"
 
-void ParticleController::Tick(ivec2 camera_pos)
+Particle::State ParticleController::GetState(std::size_t i) const
+{
+    Particle::State ret;
+    ret.pos = fvec2(data.pos_x[i], data.pos_y[i]);
+    ret.vel = fvec2(data.vel_x[i], data.vel_y[i]);
+    ret.acc = fvec2(data.acc_x[i], data.acc_y[i]);
+    ret.current_lifetime = data.current_lifetime[i];
+    return ret;
+}
+
+void ParticleController::SetState(std::size_t i, const Particle::State &state)
+{
+    data.pos_x[i] = state.pos.x;
+    data.pos_y[i] = state.pos.y;
+    data.vel_x[i] = state.vel.x;
+    data.vel_y[i] = state.vel.y;
+    data.acc_x[i] = state.acc.x;
+    data.acc_y[i] = state.acc.y;
+    data.current_lifetime[i] = state.current_lifetime;
+}
+
+void ParticleController::RemoveMarked()
 {
-    for (Particle &par : particles)
+    ASSERT(removal_mask.size() == data.Size());
+
+    data.ForEachColumn([&](auto &column)
     {
-        par.s.pos += par.s.vel;
-        par.s.vel += par.s.acc;
-        par.s.vel *= 1 - par.damp;
-        par.s.current_lifetime++;
+        std::size_t j = 0;
+        for (std::size_t i = 0; i < column.size(); i++)
+        {
+            if (!removal_mask[i])
+                column[j++] = column[i];
+        }
+        column.resize(j);
+    });
+}
+
+void ParticleController::TrimHistory()
+{
+    int first_frame = history_end_frame - int(history_frame_sizes.Size());
+    int first_needed_frame = data.Size() > 0 ? data.birth_frame.front() : history_end_frame;
+
+    while (first_frame < first_needed_frame)
+    {
+        history.PopFront(history_frame_sizes.Front());
+        history_frame_sizes.PopFront();
+        first_frame++;
+    }
+}
+
+void ParticleController::Add(const Particle &par)
+{
+    data.ForEachColumn([](auto &column){column.emplace_back();});
+    std::size_t i = data.Size() - 1;
+
+    SetState(i, par.s);
+    data.damp_factor[i] = 1 - par.damp;
+    data.life[i] = par.life;
+    data.serial[i] = next_serial++;
+    data.birth_frame[i] = history_end_frame;
 
-        if (saves_timelines)
-            states[par.state_id].push_back(par.s);
+    data.inv_life[i] = par.life > 0 ? 1.f / par.life : 0;
+    data.size_start[i] = par.size;
+    data.size_delta[i] = par.end_size ? *par.end_size - par.size : 0;
+    data.color_start[i] = par.color;
+    data.color_delta[i] = par.end_color ? *par.end_color - par.color : fvec3();
+    data.alpha_start[i] = par.alpha;
+    data.alpha_delta[i] = par.end_alpha ? *par.end_alpha - par.alpha : 0;
+    data.beta_start[i] = par.beta;
+    data.beta_delta[i] = par.end_beta ? *par.end_beta - par.beta : 0;
+}
+
+void ParticleController::Tick(ivec2 camera_pos)
+{
+    std::size_t count = data.Size();
+
+    { // Integrate. Those loops are kept trivial, so that they can be vectorized.
+        float *pos_x = data.pos_x.data(), *pos_y = data.pos_y.data();
+        float *vel_x = data.vel_x.data(), *vel_y = data.vel_y.data();
+        const float *acc_x = data.acc_x.data(), *acc_y = data.acc_y.data();
+        const float *damp_factor = data.damp_factor.data();
+        int *current_lifetime = data.current_lifetime.data();
+
+        for (std::size_t i = 0; i < count; i++)
+        {
+            pos_x[i] += vel_x[i];
+            vel_x[i] = (vel_x[i] + acc_x[i]) * damp_factor[i];
+        }
+        for (std::size_t i = 0; i < count; i++)
+        {
+            pos_y[i] += vel_y[i];
+            vel_y[i] = (vel_y[i] + acc_y[i]) * damp_factor[i];
+        }
+        for (std::size_t i = 0; i < count; i++)
+            current_lifetime[i]++;
     }
 
-    std::erase_if(particles, [&](const Particle &par)
+    // Remove dead particles.
+    fvec2 max_dist = screen_size / 2 + 16;
+    removal_mask.resize(count);
+    for (std::size_t i = 0; i < count; i++)
     {
-        bool erase = false;
-        if (par.s.current_lifetime > par.life)
-            erase = true;
-        if ((abs(par.s.pos - camera_pos) > screen_size / 2 + 16).any())
-            erase = true;
-
-        if (erase && saves_timelines)
-            state_ids.EraseUnordered(par.state_id);
-        return erase;
-    });
+        removal_mask[i] = data.current_lifetime[i] > data.life[i]
+            || abs(data.pos_x[i] - camera_pos.x) > max_dist.x || abs(data.pos_y[i] - camera_pos.y) > max_dist.y;
+    }
+    RemoveMarked();
+
+    // Save the history.
+    if (saves_timelines)
+    {
+        for (std::size_t i = 0; i < data.Size(); i++)
+            history.PushBack(HistoryRecord{data.serial[i], GetState(i)});
+        history_frame_sizes.PushBack(int(data.Size()));
+        history_end_frame++;
 
-    ASSERT(!saves_timelines || int(particles.size()) == state_ids.ElemCount());
+        TrimHistory();
+    }
 }
 
 void ParticleController::ReverseTick()
 {
-    std::erase_if(particles, [&](const Particle &par)
-    {
-        bool erase = states[par.state_id].empty();
-        if (erase && saves_timelines)
-            state_ids.EraseUnordered(par.state_id);
-        return erase;
-    });
+    if (!saves_timelines)
+        return;
 
-    for (Particle &par : particles)
+    // Both the particles and the last frame are sorted by serial, so we match them in a single pass.
+    // Particles that are not in the frame were created after it, so we remove them.
+    std::size_t frame_size = history_frame_sizes.IsEmpty() ? 0 : history_frame_sizes.Back();
+    std::size_t record_index = history.Size() - frame_size;
+
+    removal_mask.resize(data.Size());
+    for (std::size_t i = 0; i < data.Size(); i++)
     {
-        auto &state_vec = states[par.state_id];
-        if (state_vec.empty())
-            continue; // This shouldn't happen.
-        par.s = state_vec.back();
-        state_vec.pop_back();
+        while (record_index < history.Size() && history[record_index].serial < data.serial[i])
+            record_index++;
+
+        bool found = record_index < history.Size() && history[record_index].serial == data.serial[i];
+        removal_mask[i] = !found;
+        if (found)
+            SetState(i, history[record_index].state);
     }
+    RemoveMarked();
 
-    ASSERT(!saves_timelines || int(particles.size()) == state_ids.ElemCount());
+    if (!history_frame_sizes.IsEmpty())
+    {
+        history.PopBack(frame_size);
+        history_frame_sizes.PopBack();
+        history_end_frame--;
+    }
 }
 
 void ParticleController::Render(ivec2 camera_pos) const
 {
-    for (const Particle &par : particles)
+    std::vector<Render::Sprite> &sprites = r.SpriteBuffer();
+    sprites.resize(data.Size());
+
+    for (std::size_t i = 0; i < data.Size(); i++)
     {
-        float t = par.s.current_lifetime / float(par.life);
+        float t = data.current_lifetime[i] * data.inv_life[i];
 
-        float size = !par.end_size ? par.size : mix(t, par.size, *par.end_size);
-        fvec3 color = !par.end_color ? par.color : mix(t, par.color, *par.end_color);
-        float alpha = !par.end_alpha ? par.alpha : mix(t, par.alpha, *par.end_alpha);
-        float beta = !par.end_beta ? par.beta : mix(t, par.beta, *par.end_beta);
+        float size = data.size_start[i] + t * data.size_delta[i];
 
-        r.fquad(par.s.pos - camera_pos, fvec2(size)).color(color).alpha(alpha).beta(beta).center();
+        Render::Sprite &sprite = sprites[i];
+        sprite.pos = fvec2(data.pos_x[i] - size / 2, data.pos_y[i] - size / 2) - camera_pos;
+        sprite.size = fvec2(size);
+        sprite.color = data.color_start[i] + t * data.color_delta[i];
+        sprite.alpha = data.alpha_start[i] + t * data.alpha_delta[i];
+        sprite.beta = data.beta_start[i] + t * data.beta_delta[i];
     }
+
+    r.DrawSprites(sprites);
 }
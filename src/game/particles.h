@@ -1,13 +1,17 @@
 #pragma once
 
 #include "game/main.h"
+#include "utils/ring_buffer.h"
 
+// Describes a new particle, see `ParticleController::Add()`.
 struct Particle
 {
     struct State
     {
-        fvec2 pos, vel, acc;
-        int current_lifetime = 0;
+        MEMBERS(
+            DECL(fvec2) pos, vel, acc
+            DECL(int INIT = 0) current_lifetime
+        )
     };
     State s;
 
@@ -23,40 +27,90 @@ struct Particle
     std::optional<float> end_size;
 
     int life = 60;
-
-    int state_id = 0;
 };
 
 class ParticleController
 {
-    std::deque<Particle> particles;
+    // The particles are stored as a structure of arrays, so that `Tick()` can be vectorized.
+    // All vectors have the same size. The particles are sorted by `serial`.
+    struct Storage
+    {
+        MEMBERS(
+            DECL(std::vector<float>) pos_x, pos_y, vel_x, vel_y, acc_x, acc_y
+            DECL(std::vector<float>) damp_factor // `1 - damp`.
+            DECL(std::vector<int>) current_lifetime, life
+            DECL(std::vector<std::uint64_t>) serial // Unique increasing particle ids, used to match them with the history.
+            DECL(std::vector<int>) birth_frame // The history frame that will contain the first state of this particle.
+
+            // The interpolated values are `start + t * delta`, where `t = current_lifetime * inv_life`.
+            DECL(std::vector<float>) inv_life
+            DECL(std::vector<float>) size_start, size_delta
+            DECL(std::vector<fvec3>) color_start, color_delta
+            DECL(std::vector<float>) alpha_start, alpha_delta
+            DECL(std::vector<float>) beta_start, beta_delta
+        )
+
+        // Calls `func` for each of the vectors above.
+        template <typename F>
+        void ForEachColumn(F &&func)
+        {
+            func(pos_x); func(pos_y); func(vel_x); func(vel_y); func(acc_x); func(acc_y);
+            func(damp_factor);
+            func(current_lifetime); func(life);
+            func(serial); func(birth_frame);
+            func(inv_life);
+            func(size_start); func(size_delta);
+            func(color_start); func(color_delta);
+            func(alpha_start); func(alpha_delta);
+            func(beta_start); func(beta_delta);
+        }
+
+        [[nodiscard]] std::size_t Size() const
+        {
+            return pos_x.size();
+        }
+    };
+    // The history, used for reversing time. Each tick appends a frame with the states of all surviving particles, sorted by serial.
+    struct HistoryRecord
+    {
+        MEMBERS(
+            DECL(std::uint64_t INIT = 0) serial
+            DECL(Particle::State) state
+        )
+    };
+
+    MEMBERS(
+        DECL(Storage) data
 
-    std::vector<std::vector<Particle::State>> states;
-    SparseSet<int> state_ids;
+        // Particles with nonzero values here are removed by `RemoveMarked()`.
+        DECL(std::vector<unsigned char>) removal_mask
 
-    bool saves_timelines = false;
+        DECL(std::uint64_t INIT = 0) next_serial
+
+        DECL(RingBuffer<HistoryRecord>) history // All frames, concatenated.
+        DECL(RingBuffer<int>) history_frame_sizes
+        DECL(int INIT = 0) history_end_frame // The absolute index of the frame after the last one.
+
+        DECL(bool INIT = false) saves_timelines
+    )
+
+    [[nodiscard]] Particle::State GetState(std::size_t i) const;
+    void SetState(std::size_t i, const Particle::State &state);
+
+    // Removes particles marked in `removal_mask`, preserving the order of the rest.
+    void RemoveMarked();
+
+    // Removes the frames that are older than any existing particle.
+    void TrimHistory();
 
 public:
     ParticleController(bool saves_timelines) : saves_timelines(saves_timelines) {}
 
-    void Add(const Particle &par)
-    {
-        if (saves_timelines && state_ids.IsFull())
-        {
-            state_ids.Reserve((state_ids.Capacity() + 1) * 2);
-            while (int(states.size()) < state_ids.Capacity())
-            {
-                states.emplace_back();
-                states.back().reserve(1024);
-            }
-        }
+    void Add(const Particle &par);
 
-        Particle &new_par = particles.emplace_back(par);
-        if (saves_timelines)
-        {
-            new_par.state_id = state_ids.InsertAny();
-            states[new_par.state_id].clear(); // This shouldn't reset capacity, this is intentional.
-        }
+    [[nodiscard]] std::size_t Size() const
+    {
+        return data.Size();
     }
 
     void Tick(ivec2 camera_pos);
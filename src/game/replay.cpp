@@ -0,0 +1,129 @@
+#include "replay.h"
+
+namespace Replay
+{
+    std::uint16_t PackControls(const Controls &con)
+    {
+        std::uint16_t ret = 0;
+        int i = 0;
+        con.ForEachButton([&](const Controls::Button &button)
+        {
+            ret |= (button.is_down << (i * 3)) | (button.is_pressed << (i * 3 + 1)) | (button.is_released << (i * 3 + 2));
+            i++;
+        });
+        return ret;
+    }
+
+    void UnpackControls(Controls &con, std::uint16_t bits)
+    {
+        int i = 0;
+        con.ForEachButton([&](Controls::Button &button)
+        {
+            button.is_down = bits & (1 << (i * 3));
+            button.is_pressed = bits & (1 << (i * 3 + 1));
+            button.is_released = bits & (1 << (i * 3 + 2));
+            i++;
+        });
+    }
+}
+
+RecordingControls::RecordingControls(std::unique_ptr<ControlsSource> source, std::string file_name, std::uint32_t seed)
+    : source(std::move(source)), output(std::move(file_name))
+{
+    output.WriteString(std::string(Replay::magic));
+    output.WriteLittle<std::uint32_t>(Replay::version);
+    output.WriteLittle<std::uint32_t>(seed);
+}
+
+RecordingControls::~RecordingControls()
+{
+    try
+    {
+        Finish();
+    }
+    catch (...) {}
+}
+
+void RecordingControls::WriteRun()
+{
+    if (run_length == 0)
+        return;
+
+    output.WriteLittle<std::uint16_t>(run_bits);
+
+    std::uint64_t value = run_length;
+    while (value >= 0x80)
+    {
+        output.WriteByte((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    output.WriteByte(value);
+
+    run_length = 0;
+}
+
+void RecordingControls::Update(Controls &con)
+{
+    source->Update(con);
+
+    std::uint16_t bits = Replay::PackControls(con);
+    if (bits != run_bits)
+    {
+        WriteRun();
+        run_bits = bits;
+    }
+    run_length++;
+}
+
+void RecordingControls::Finish()
+{
+    if (!output)
+        return;
+    WriteRun();
+    output.Flush();
+}
+
+ReplayControls::ReplayControls(std::string file_name)
+    : input(std::move(file_name))
+{
+    std::string file_magic(Replay::magic.size(), '\0');
+    input.Read(file_magic.data(), file_magic.size());
+    if (file_magic != Replay::magic)
+        Program::Error(input.GetExceptionPrefix() + "This is not a replay file.");
+
+    std::uint32_t file_version = input.ReadLittle<std::uint32_t>();
+    if (file_version != Replay::version)
+        Program::Error(input.GetExceptionPrefix() + FMT("Unsupported replay version {}, expected {}.", file_version, Replay::version));
+
+    seed = input.ReadLittle<std::uint32_t>();
+}
+
+void ReplayControls::Update(Controls &con)
+{
+    if (run_ticks_left == 0)
+    {
+        if (!input.MoreData())
+        {
+            con.ForEachButton([](Controls::Button &button){button.Update(false);});
+            return;
+        }
+
+        run_bits = input.ReadLittle<std::uint16_t>();
+
+        run_ticks_left = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            std::uint8_t byte = input.ReadByte();
+            run_ticks_left |= std::uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+            if (shift >= 63)
+                Program::Error(input.GetExceptionPrefix() + "Invalid run length.");
+        }
+        if (run_ticks_left == 0)
+            Program::Error(input.GetExceptionPrefix() + "Invalid run length.");
+    }
+
+    Replay::UnpackControls(con, run_bits);
+    run_ticks_left--;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "game/controls.h"
+
+// Input recordings, which let you replay a run tick by tick.
+// The format is:
+//     "FLREPLAY", the version (u32), the random seed (u32),
+//     then a list of runs: the controls state (u16), and the number of ticks it lasts (LEB128 varint).
+// The state has 3 bits per button (down, pressed, released), in the same order as `Controls::ForEachButton()`.
+// All numbers are little-endian.
+namespace Replay
+{
+    inline constexpr std::string_view magic = "FLREPLAY";
+    inline constexpr std::uint32_t version = 1;
+
+    [[nodiscard]] std::uint16_t PackControls(const Controls &con);
+    void UnpackControls(Controls &con, std::uint16_t bits);
+}
+
+// Reads controls from a different source, and writes them to a file.
+// Nothing is buffered in memory, except for the current run.
+class RecordingControls : public ControlsSource
+{
+    std::unique_ptr<ControlsSource> source;
+    Stream::Output output;
+
+    std::uint16_t run_bits = 0;
+    std::uint64_t run_length = 0;
+
+    void WriteRun();
+
+  public:
+    RecordingControls(std::unique_ptr<ControlsSource> source, std::string file_name, std::uint32_t seed);
+
+    RecordingControls(const RecordingControls &) = delete;
+    RecordingControls &operator=(const RecordingControls &) = delete;
+
+    ~RecordingControls();
+
+    void Update(Controls &con) override;
+
+    // Writes the last run and flushes the file. This is called automatically by the destructor.
+    void Finish();
+};
+
+// Plays back a recording, streaming it from the disk.
+// After the recording ends, all buttons are released.
+class ReplayControls : public ControlsSource
+{
+    Stream::Input input;
+    std::uint32_t seed = 0;
+
+    std::uint16_t run_bits = 0;
+    std::uint64_t run_ticks_left = 0;
+
+  public:
+    ReplayControls(std::string file_name);
+
+    // The random seed used when recording.
+    [[nodiscard]] std::uint32_t Seed() const
+    {
+        return seed;
+    }
+
+    // Returns true if all recorded ticks were played back.
+    [[nodiscard]] bool IsFinished() const
+    {
+        return run_ticks_left == 0 && !input.MoreData();
+    }
+
+    void Update(Controls &con) override;
+};
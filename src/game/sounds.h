@@ -19,15 +19,20 @@
 
 namespace Sounds
 {
+    // Without an audio context (in the headless mode) those play nothing and return null,
+    // but still generate the random pitch, to keep the simulation identical.
     #define MAKE_SOUND(name, randpitch) \
         inline std::shared_ptr<Audio::Source> name(std::optional<ivec2> pos, float volume = 1, float pitch = 0) \
         { \
+            float final_pitch = pow(2, pitch - (ra.f.abs() <= randpitch)); \
+            if (!audio_context) \
+                return nullptr; \
             auto ret = audio_controller.Add(Audio::File<#name>()); \
             if (pos) \
                 ret->pos(*pos); \
             else \
                 ret->relative(); \
-            ret->volume(volume).pitch(pow(2, pitch - (ra.f.abs() <= randpitch))).play(); \
+            ret->volume(volume).pitch(final_pitch).play(); \
             return ret; \
         } \
         inline std::shared_ptr<Audio::Source> name(float volume = 1, float pitch = 0) \
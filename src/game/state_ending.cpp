@@ -97,7 +97,7 @@ namespace States
             }
 
             { // Vignette.
-                static const auto &region = texture_atlas.Get("vignette.png");
+                const auto &region = Graphics::AtlasRegion<"vignette.png">();
                     r.iquad(ivec2(), region).alpha(vignette_alpha).center();
             }
 
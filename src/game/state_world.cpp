@@ -1,61 +1,17 @@
 #include "main.h"
 
+#include "game/benchmarks.h"
 #include "game/buildnumber.h"
+#include "game/controls.h"
 #include "game/map.h"
 #include "game/particles.h"
 #include "game/sounds.h"
+#include "utils/archive.h"
+#include "utils/delta_timeline.h"
+#include "utils/interval_index.h"
 
 constexpr int max_timeshifts = 255;
 
-struct Controls
-{
-    struct Button
-    {
-        std::vector<Input::Button> buttons;
-
-        [[nodiscard]] bool down() const
-        {
-            for (const Input::Button &button : buttons)
-                if (button.down())
-                    return true;
-            return false;
-        }
-
-        [[nodiscard]] bool pressed() const
-        {
-            bool ok = false;
-            for (const Input::Button &button : buttons)
-            {
-                if (button.down() && !button.pressed())
-                    return false;
-                if (button.pressed())
-                    ok = true;
-            }
-            return ok;
-        }
-
-        [[nodiscard]] bool released() const
-        {
-            bool ok = false;
-            for (const Input::Button &button : buttons)
-            {
-                if (button.down())
-                    return false;
-                if (button.released())
-                    ok = true;
-            }
-            return ok;
-        }
-    };
-
-    Button left = {{Input::left, Input::a}};
-    Button right = {{Input::right, Input::d}};
-    Button jump = {{Input::space, Input::c, Input::j, Input::up, Input::w}};
-    Button shoot = {{Input::x, Input::k}};
-    Button timeshift = {{Input::z, Input::l}};
-};
-Controls con;
-
 struct Shot
 {
     inline static const std::vector<ivec2> hitbox = {
@@ -68,31 +24,24 @@ struct Shot
         return time / 5 % 6;
     }
 
-    fvec2 pos;
-    fvec2 vel;
+    MEMBERS(
+        DECL(fvec2) pos, vel
+    )
 };
 
 // Note, this structure is copied into timelines...
 struct Player
 {
-    inline static const std::vector<ivec2> hitbox = {
-        ivec2(-4, -9), ivec2(3, -9),
-        ivec2(-4,  0), ivec2(3,  0),
-        ivec2(-4,  8), ivec2(3,  8),
-    };
-
-    inline static const std::vector<ivec2> spike_hitbox = {
-        ivec2(-4,  0), ivec2(3,  0),
-    };
+    // The hitboxes are checked against whole tiles, so they must be smaller than a tile in every dimension,
+    //   or the tile boundaries must not matter. Both boundaries are inclusive.
+    static constexpr ivec2 hitbox_a = ivec2(-4, -9), hitbox_b = ivec2(3, 8);
+    static constexpr ivec2 spike_hitbox_a = ivec2(-4, 0), spike_hitbox_b = ivec2(3, 0);
 
     static constexpr ivec2 shot_hitbox_halfsize = ivec2(8,8);
 
     [[nodiscard]] static bool SolidAtPos(const Map &map, ivec2 pos)
     {
-        for (ivec2 point : hitbox)
-            if (map.at_pixel(pos + point).info().solid)
-                return true;
-        return false;
+        return map.AnyInPixelRect(map.solid_tiles, pos + hitbox_a, pos + hitbox_b);
     }
 
     [[nodiscard]] bool SolidAtOffset(const Map &map, ivec2 offset) const
@@ -105,94 +54,242 @@ struct Player
         return !dead && !in_prison;
     }
 
-    ivec2 pos;
-    fvec2 vel;
-    fvec2 prev_vel;
-    fvec2 vel_lag;
+    MEMBERS(
+        DECL(ivec2) pos
+        DECL(fvec2) vel
+        DECL(fvec2) prev_vel
+        DECL(fvec2) vel_lag
 
-    bool ground = false;
-    bool prev_ground = false;
+        DECL(bool INIT = false) ground
+        DECL(bool INIT = false) prev_ground
 
-    bool doublejump_recharged = false;
+        DECL(bool INIT = false) doublejump_recharged
 
-    bool facing_left = false;
+        DECL(bool INIT = false) facing_left
 
-    bool is_walking = false;
-    int walking_timer = 0;
+        DECL(bool INIT = false) is_walking
+        DECL(int INIT = 0) walking_timer
 
-    bool dead = false;
-    int death_timer = 0;
+        DECL(bool INIT = false) dead
+        DECL(int INIT = 0) death_timer
 
-    int anim_state = 0;
-    int anim_variant = 0;
+        DECL(int INIT = 0) anim_state
+        DECL(int INIT = 0) anim_variant
 
-    bool in_prison = true;
-    int prison_hp_left = 3;
+        DECL(bool INIT = true) in_prison
+        DECL(int INIT = 3) prison_hp_left
 
-    std::optional<Shot> shot;
+        DECL(std::optional<Shot>) shot
 
-    int remaining_boost_frames = 0;
-    fvec2 boost_vel;
+        DECL(int INIT = 0) remaining_boost_frames
+        DECL(fvec2) boost_vel
 
-    // This is here, because we need to save it to the timeline.
-    float lava_y = 0;
+        // This is here, because we need to save it to the timeline.
+        DECL(float INIT = 0) lava_y
+    )
+};
+
+// Converts `Player` to words for `DeltaTimeline`. Update this when adding fields to `Player`.
+struct PlayerTimelineCodec
+{
+    using type = Player;
+    static constexpr std::size_t size = 22;
+
+    static void Pack(const Player &p, std::uint32_t *w)
+    {
+        auto f = [](float x){return std::bit_cast<std::uint32_t>(x);};
+
+        *w++ = p.pos.x;
+        *w++ = p.pos.y;
+        *w++ = f(p.vel.x);
+        *w++ = f(p.vel.y);
+        *w++ = f(p.prev_vel.x);
+        *w++ = f(p.prev_vel.y);
+        *w++ = f(p.vel_lag.x);
+        *w++ = f(p.vel_lag.y);
+        *w++ = (p.ground << 0) | (p.prev_ground << 1) | (p.doublejump_recharged << 2) | (p.facing_left << 3) | (p.is_walking << 4) | (p.dead << 5) | (p.in_prison << 6) | (p.shot.has_value() << 7);
+        *w++ = p.walking_timer;
+        *w++ = p.death_timer;
+        *w++ = p.anim_state;
+        *w++ = p.anim_variant;
+        *w++ = p.prison_hp_left;
+        *w++ = p.shot ? f(p.shot->pos.x) : 0;
+        *w++ = p.shot ? f(p.shot->pos.y) : 0;
+        *w++ = p.shot ? f(p.shot->vel.x) : 0;
+        *w++ = p.shot ? f(p.shot->vel.y) : 0;
+        *w++ = p.remaining_boost_frames;
+        *w++ = f(p.boost_vel.x);
+        *w++ = f(p.boost_vel.y);
+        *w++ = f(p.lava_y);
+    }
+
+    static void Unpack(Player &p, const std::uint32_t *w)
+    {
+        auto f = [](std::uint32_t x){return std::bit_cast<float>(x);};
+
+        p.pos.x = *w++;
+        p.pos.y = *w++;
+        p.vel.x = f(*w++);
+        p.vel.y = f(*w++);
+        p.prev_vel.x = f(*w++);
+        p.prev_vel.y = f(*w++);
+        p.vel_lag.x = f(*w++);
+        p.vel_lag.y = f(*w++);
+        std::uint32_t flags = *w++;
+        p.ground               = flags & (1 << 0);
+        p.prev_ground          = flags & (1 << 1);
+        p.doublejump_recharged = flags & (1 << 2);
+        p.facing_left          = flags & (1 << 3);
+        p.is_walking           = flags & (1 << 4);
+        p.dead                 = flags & (1 << 5);
+        p.in_prison            = flags & (1 << 6);
+        p.walking_timer = *w++;
+        p.death_timer = *w++;
+        p.anim_state = *w++;
+        p.anim_variant = *w++;
+        p.prison_hp_left = *w++;
+        if (flags & (1 << 7))
+        {
+            p.shot.emplace();
+            p.shot->pos.x = f(w[0]);
+            p.shot->pos.y = f(w[1]);
+            p.shot->vel.x = f(w[2]);
+            p.shot->vel.y = f(w[3]);
+        }
+        else
+        {
+            p.shot.reset();
+        }
+        w += 4;
+        p.remaining_boost_frames = *w++;
+        p.boost_vel.x = f(*w++);
+        p.boost_vel.y = f(*w++);
+        p.lava_y = f(*w++);
+    }
 };
 
 struct Ghost
 {
-    int time_start = 0;
-    std::vector<Player> states;
+    MEMBERS(
+        DECL(int INIT = 0) time_start
+        DECL(DeltaTimeline<PlayerTimelineCodec>) states
 
-    bool prev_visible = false;
-    bool prev_shot_visible = false;
+        DECL(bool INIT = false) prev_visible
+        DECL(bool INIT = false) prev_shot_visible
+    )
 };
 struct TimeManager
 {
-    std::vector<Ghost> ghosts;
-    int time = 0;
+    // See `broken_blocks` below.
+    struct BrokenBlock
+    {
+        MEMBERS(
+            DECL(int INIT = 0) time
+            DECL(ivec2) pos
+        )
+    };
+
+    MEMBERS(
+        DECL(std::vector<Ghost>) ghosts
+        DECL(int INIT = 0) time
+
+        // Ghosts that had `prev_visible` or `prev_shot_visible` set after the last `AddGhostParticles()` call.
+        DECL(std::vector<int>) visible_ghosts
+
+        DECL(bool INIT = false) shifting_now
 
-    bool shifting_now = false;
+        DECL(float INIT = 0) shifting_speed
+        DECL(float INIT = 0) shifting_lag
 
-    float shifting_speed = 0;
-    float shifting_lag = 0;
+        DECL(float INIT = 1) positive_speed // Used to slowly gain time speed after shift.
 
-    float positive_speed = 1; // Used to slowly gain time speed after shift.
+        DECL(float INIT = 0) shifting_effects_alpha
 
-    float shifting_effects_alpha = 0;
+        // Blocks that were broken at some point, sorted by time.
+        // Only the blocks broken before the current time are listed. The rest are restored and removed by `RestoreBrokenBlocks()`.
+        DECL(std::vector<BrokenBlock>) broken_blocks
+    )
 
-    std::map<ivec2, int> block_breaking_times;
+    // Intervals of time covered by each ghost, indexed in the same way as `ghosts`.
+    // Not serialized, `RebuildGhostIntervals()` recomputes it.
+    IntervalIndex ghost_intervals;
+
+    void RebuildGhostIntervals()
+    {
+        ghost_intervals.Clear();
+        for (const Ghost &ghost : ghosts)
+            ghost_intervals.Add(ghost.time_start, ghost.time_start + ghost.states.Size());
+    }
 
     void NextTimeline()
     {
         ghosts.emplace_back();
         ghosts.back().time_start = time;
+        ghost_intervals.Add(time, time);
     }
 
     void SavePlayer(const Player &p)
     {
         if (ghosts.empty())
             NextTimeline();
-        ghosts.back().states.push_back(p);
+        Ghost &ghost = ghosts.back();
+        ghost.states.PushBack(p);
+        ghost_intervals.SetEnd(int(ghosts.size()) - 1, ghost.time_start + ghost.states.Size());
+    }
+
+    void BreakBlock(ivec2 pos)
+    {
+        // The blocks are always broken at the current time, and everything after it was already restored, so this preserves the order.
+        ASSERT(broken_blocks.empty() || broken_blocks.back().time <= time);
+        broken_blocks.push_back({time, pos});
+    }
+
+    // Calls `func(ivec2 pos)` for every block broken after the current time, and forgets those blocks.
+    // Only the blocks that need restoring are visited, newest first.
+    template <typename F>
+    void RestoreBrokenBlocks(F &&func)
+    {
+        while (!broken_blocks.empty() && broken_blocks.back().time > time)
+        {
+            func(broken_blocks.back().pos);
+            broken_blocks.pop_back();
+        }
+    }
+
+    // Returns indices of ghosts that have a state for the current time, in ascending order.
+    [[nodiscard]] const std::vector<int> &LiveGhosts() const
+    {
+        return ghost_intervals.At(time);
     }
 
     void AddGhostParticles(ParticleController &par)
     {
         const Ghost *last_ghost = FindNewestGhost();
 
-        for (Ghost &ghost : ghosts)
+        // Dead ghosts can't change, unless they were visible the last time, so we only need to check those two sets.
+        std::vector<int> candidates;
+        const std::vector<int> &live_ghosts = LiveGhosts();
+        std::set_union(live_ghosts.begin(), live_ghosts.end(), visible_ghosts.begin(), visible_ghosts.end(), std::back_inserter(candidates));
+
+        for (int ghost_index : candidates)
         {
-            if (ghost.states.empty())
+            Ghost &ghost = ghosts[ghost_index];
+            if (ghost.states.IsEmpty())
                 continue;
             if (&ghost == last_ghost)
                 continue;
 
             int rel_time = time - ghost.time_start;
 
-            bool visible = time >= ghost.time_start && rel_time < int(ghost.states.size()) && ghost.states[rel_time].VisibleAsGhost();
+            std::optional<Player> cur_state;
+            if (time >= ghost.time_start && rel_time < ghost.states.Size())
+                cur_state = ghost.states[rel_time];
+
+            bool visible = cur_state && cur_state->VisibleAsGhost();
 
             if (visible != ghost.prev_visible)
             {
-                const Player &state = ghost.states[clamp(rel_time, 0, int(ghost.states.size()) - 1)];
+                Player state = ghost.states[clamp(rel_time, 0, ghost.states.Size() - 1)];
                 ghost.prev_visible = visible;
                 for (int i = 0; i < 24; i++)
                 {
@@ -206,20 +303,20 @@ struct TimeManager
                 }
             }
 
-            bool shot_visible = visible && ghost.states[rel_time].shot;
+            bool shot_visible = visible && cur_state->shot;
             if (shot_visible != ghost.prev_shot_visible)
             {
                 ghost.prev_shot_visible = shot_visible;
 
                 // Try to guess the shot pos.
-                int index = clamp(rel_time, 0, int(ghost.states.size()) - 1);
+                int index = clamp(rel_time, 0, ghost.states.Size() - 1);
                 std::optional<fvec2> shot_pos;
-                if (const auto &opt = ghost.states[index].shot)
+                if (const auto opt = ghost.states[index].shot)
                     shot_pos = opt->pos;
-                else if (index > 0 && ghost.states[index-1].shot)
-                    shot_pos = ghost.states[index-1].shot->pos;
-                else if (index + 1 < int(ghost.states.size()) && ghost.states[index+1].shot)
-                    shot_pos = ghost.states[index+1].shot->pos;
+                else if (const auto prev = index > 0 ? ghost.states[index-1].shot : std::nullopt)
+                    shot_pos = prev->pos;
+                else if (const auto next = index + 1 < ghost.states.Size() ? ghost.states[index+1].shot : std::nullopt)
+                    shot_pos = next->pos;
 
                 if (shot_pos)
                 {
@@ -236,26 +333,28 @@ struct TimeManager
                 }
             }
         }
+
+        std::erase_if(candidates, [&](int ghost_index){return !ghosts[ghost_index].prev_visible && !ghosts[ghost_index].prev_shot_visible;});
+        visible_ghosts = std::move(candidates);
     }
 
     void RenderGhosts(ivec2 camera_pos) const
     {
-        static const auto &pl_region = texture_atlas.Get("player.png");
-        static const auto &shot_region = texture_atlas.Get("shot.png");
+        const auto &pl_region = Graphics::AtlasRegion<"player.png">();
+        const auto &shot_region = Graphics::AtlasRegion<"shot.png">();
         constexpr ivec2 pl_size(36);
 
         const Ghost *last_ghost = FindNewestGhost();
 
-        for (const Ghost &ghost : ghosts)
+        std::vector<Render::Sprite> &sprites = r.SpriteBuffer();
+
+        for (int ghost_index : LiveGhosts())
         {
+            const Ghost &ghost = ghosts[ghost_index];
             if (&ghost == last_ghost)
                 continue; // Skip the last ghost.
 
-            if (time < ghost.time_start)
-                continue; // Too early.
             int rel_time = time - ghost.time_start;
-            if (rel_time >= int(ghost.states.size()))
-                continue; // Too late.
 
             if (!ghost.states[rel_time].VisibleAsGhost())
                 continue; // Invisible, possibly dead.
@@ -265,7 +364,7 @@ struct TimeManager
             for (int i = -max_time_offset; i <= max_time_offset; i++)
             {
                 int this_rel_time = rel_time + i;
-                if (this_rel_time < 0 || this_rel_time >= int(ghost.states.size()))
+                if (this_rel_time < 0 || this_rel_time >= ghost.states.Size())
                     continue; // The time for this sprite is out of range.
 
                 float alpha = 0.45 - abs(i) * 0.1;
@@ -274,51 +373,64 @@ struct TimeManager
                 if (i > 0)
                     std::swap(color.x, color.z);
 
-                const Player &p = ghost.states[this_rel_time];
+                Player p = ghost.states[this_rel_time];
 
                 { // Player.
-                    ivec2 rel_pos = p.pos - camera_pos;
-                    if ((rel_pos < screen_size / 2 + 24).all())
-                        r.iquad(p.pos - camera_pos, pl_region.region(pl_size * ivec2(p.anim_variant, p.anim_state), pl_size)).center().color(color).mix(0).alpha(alpha).beta(0).flip_x(p.facing_left);
+                    Render::Sprite &sprite = sprites.emplace_back();
+                    sprite.pos = p.pos - camera_pos - pl_size / 2;
+                    sprite.size = pl_size;
+                    sprite.tex_pos = pl_region.pos + pl_size * ivec2(p.anim_variant, p.anim_state);
+                    sprite.has_texture = true;
+                    sprite.flip_x = p.facing_left;
+                    sprite.color = color;
+                    sprite.mix = 0;
+                    sprite.alpha = alpha;
+                    sprite.beta = 0;
                 }
 
                 // Shot.
                 if (p.shot)
                 {
-                    fvec2 rel_pos = p.shot->pos - camera_pos;
-                    if ((rel_pos <= screen_size / 2 + 16).all())
-                        r.fquad(rel_pos, shot_region.region(ivec2(shot_region.size.y * Shot::GetAnimVariant(time), 0), ivec2(shot_region.size.y))).center().flip_x(p.shot->vel.x < 0).color(color).mix(0).alpha(alpha).beta(0);
+                    Render::Sprite &sprite = sprites.emplace_back();
+                    sprite.pos = p.shot->pos - camera_pos - shot_region.size.y / 2.f;
+                    sprite.size = fvec2(shot_region.size.y);
+                    sprite.tex_pos = shot_region.pos + ivec2(shot_region.size.y * Shot::GetAnimVariant(time), 0);
+                    sprite.has_texture = true;
+                    sprite.flip_x = p.shot->vel.x < 0;
+                    sprite.color = color;
+                    sprite.mix = 0;
+                    sprite.alpha = alpha;
+                    sprite.beta = 0;
                 }
             }
         }
+
+        r.DrawSprites(sprites);
     }
 
     // Find newest ghost for the current time.
     // Returns null on failure.
     const Ghost *FindNewestGhost() const
     {
-        for (std::size_t i = ghosts.size(); i-- > 0;)
-        {
-            const Ghost &ghost = ghosts[i];
-            if (ghost.time_start <= time)
-            {
-                int rel_time = time - ghost.time_start;
-                if (rel_time >= int(ghost.states.size()))
-                    return nullptr; // Note, not `continue`. This is more sane.
-                return &ghost;
-            }
-        }
-        return nullptr;
+        int index = ghost_intervals.NewestBeginningAtOrBefore(time);
+        if (index == -1)
+            return nullptr;
+
+        const Ghost &ghost = ghosts[index];
+        int rel_time = time - ghost.time_start;
+        if (rel_time >= ghost.states.Size())
+            return nullptr; // Note, we don't look for older ghosts. This is more sane.
+        return &ghost;
     }
 
     // Find newest player state for the current time.
     // Returns null on failure.
-    const Player *FindNewestState() const
+    std::optional<Player> FindNewestState() const
     {
         const Ghost *ret = FindNewestGhost();
         if (ret)
-            return &ret->states[time - ret->time_start];
-        return nullptr;
+            return ret->states[time - ret->time_start];
+        return {};
     }
 
     int RemainingShifts() const
@@ -327,50 +439,76 @@ struct TimeManager
     }
 };
 
+template <>
+struct Refl::StructCallbacks<TimeManager> : Refl::DefaultStructCallbacks<TimeManager>
+{
+    static void PostDeserialize(TimeManager &time)
+    {
+        time.RebuildGhostIntervals();
+    }
+};
+
 namespace States
 {
-    STRUCT( World EXTENDS StateBase )
+    // The part of `World` that's saved in snapshots, see `World::SaveSnapshot()`.
+    // Everything that changes while playing must be declared here, otherwise it won't be saved.
+    struct WorldData
     {
-        MEMBERS()
+        struct Hint
+        {
+            MEMBERS(
+                DECL(ivec2) pos
+                DECL(std::string) message
+                DECL(float INIT = 0) alpha
+            )
+        };
+
+        MEMBERS(
+            DECL(int INIT = 0) real_world_time
 
-        int real_world_time = 0;
+            DECL(Map INIT = Stream::ReadOnlyData(Program::ExeDir() + "map.json")) map
+            DECL(Map INIT = map) map_orig
 
-        Map map = Stream::ReadOnlyData(Program::ExeDir() + "map.json");
-        Map map_orig = map;
+            DECL(Player) p
+            DECL(ParticleController INIT = true) par
+            DECL(ParticleController INIT = false) par_timeless
+            DECL(TimeManager) time
 
-        Player p;
-        ParticleController par = true;
-        ParticleController par_timeless = false;
-        TimeManager time;
+            DECL(ivec2) camera_pos
 
-        ivec2 camera_pos;
+            DECL(Controls) con
+            DECL(bool INIT = false) buffered_jump
 
-        bool buffered_jump = false;
+            DECL(float INIT = 1) fade
+            DECL(float INIT = 0) exit_fade
 
-        float fade = 1;
-        float exit_fade = 0;
+            // Those are not in `Player`, because we don't want to roll them back.
+            DECL(int INIT = 0) prison_timer
+            DECL(ivec2) prison_sprite_offset
+            DECL(int INIT = 0) prison_anim_timer
 
-        // Those are not in `Player`, because we don't want to roll them back.
-        int prison_timer = 0;
-        ivec2 prison_sprite_offset;
-        int prison_anim_timer = 0;
+            DECL(bool INIT = false) have_timeshift_ability, have_doublejump_ability, have_gun_ability
 
-        bool have_timeshift_ability = false;
-        bool have_doublejump_ability = false;
-        bool have_gun_ability = false;
+            DECL(int INIT = 0) time_since_got_timeshift
 
-        int time_since_got_timeshift = 0;
+            DECL(std::string) ability_message, ability_message2
+            DECL(int INIT = 0) ability_timer
 
-        std::string ability_message, ability_message2;
-        int ability_timer = 0;
+            DECL(bool INIT = false) seen_hint_death_rollback
+            DECL(float INIT = 0) hint_death_hollback
 
-        bool seen_hint_death_rollback = false;
-        float hint_death_hollback = 0;
+            DECL(bool INIT = false) seen_hint_jump
+            DECL(float INIT = 0) hint_jump
 
-        bool seen_hint_jump = false;
-        float hint_jump = 0;
+            DECL(float INIT = 1) logo_alpha
 
-        float logo_alpha = 1;
+            DECL(std::vector<Hint>) hints
+        )
+    };
+
+    STRUCT( World EXTENDS StateBase SILENTLY_EXTENDS WorldData )
+    {
+        MEMBERS()
 
         static constexpr fvec3
             sky_color = fvec3(0.6f, 0.935f, 1),
@@ -381,14 +519,10 @@ namespace States
 
         static constexpr int ability_anim_len = 440;
 
-
-        struct Hint
-        {
-            ivec2 pos;
-            std::string message;
-            float alpha = 0;
-        };
-        std::vector<Hint> hints;
+        // The state right after the construction, used to restart quickly. It's the same for every world, so we only compute it once.
+        inline static std::vector<unsigned char> initial_snapshot;
+        // If set, the next tick restores `initial_snapshot`.
+        bool restart_queued = false;
 
         World()
         {
@@ -420,12 +554,49 @@ namespace States
                 if (map.debug_start_with_gun)
                     have_gun_ability = true;
             }
+
+            if (initial_snapshot.empty())
+                initial_snapshot = SaveSnapshot();
+        }
+
+        // Returns a compressed binary snapshot of the world.
+        [[nodiscard]] std::vector<unsigned char> SaveSnapshot() const override
+        {
+            std::vector<unsigned char> raw;
+            Stream::Output output = Stream::Output::Container(raw);
+            Refl::ToBinary(static_cast<const WorldData &>(*this), output);
+            output.Flush();
+
+            std::vector<unsigned char> ret(Archive::MaxCompressedSize(raw.data(), raw.data() + raw.size()));
+            ret.resize(Archive::Compress(raw.data(), raw.data() + raw.size(), ret.data(), ret.data() + ret.size()) - ret.data());
+            return ret;
+        }
+
+        // Restores a snapshot returned by `SaveSnapshot()`. On failure, throws and leaves the world in an unspecified state.
+        void LoadSnapshot(Stream::ReadOnlyData snapshot) override
+        {
+            Stream::Input input = snapshot.uncompress();
+            input.WantLocationStyle(Stream::byte_offset);
+            WorldData &data = *this;
+            Refl::InterfaceFor(data).FromBinary(data, input, {}, Refl::initial_state);
+            input.ExpectEnd();
         }
 
         void Tick(std::string &next_state) override
         {
+            if (restart_queued)
+            {
+                restart_queued = false;
+                LoadSnapshot(Stream::ReadOnlyData::mem_reference(initial_snapshot));
+                // Constructing a new world would've rolled new tile variants, so we do the same.
+                map.RandomizeTileVariants();
+                map_orig.random = map.random;
+            }
+
             real_world_time++;
 
+            controls_source->Update(con);
+
             constexpr float gravity = 0.1, low_jump_gravity = 0.3;
 
             bool positive_time_step_this_tick = false;
@@ -547,11 +718,10 @@ namespace States
             }
 
             { // Restore block state from the timeline.
-                for (const auto &[pos, break_time] : time.block_breaking_times)
+                time.RestoreBrokenBlocks([&](ivec2 pos)
                 {
-                    if (time.time < break_time)
-                        map.at(pos).tile = map_orig.at(pos).tile;
-                }
+                    map.SetTile(pos, map_orig.at(pos).tile);
+                });
             }
 
             // Player.
@@ -657,25 +827,26 @@ namespace States
                         if (!can_jump && have_doublejump_ability && p.doublejump_recharged)
                         {
                             const Ghost *newest_ghost = time.FindNewestGhost();
-                            auto it = std::find_if(time.ghosts.begin(), time.ghosts.end(), [&](const Ghost &ghost)
+                            const std::vector<int> &live_ghosts = time.LiveGhosts();
+                            auto it = std::find_if(live_ghosts.begin(), live_ghosts.end(), [&](int ghost_index)
                             {
+                                const Ghost &ghost = time.ghosts[ghost_index];
                                 if (&ghost == newest_ghost)
                                     return false;
-                                if (time.time < ghost.time_start)
-                                    return false;
-                                int rel_time = time.time - ghost.time_start;
-                                if (rel_time >= int(ghost.states.size()))
-                                    return false;
-                                const Player &state = ghost.states[rel_time];
+                                Player state = ghost.states[time.time - ghost.time_start];
                                 if (!state.VisibleAsGhost())
                                     return false;
                                 return (abs(state.pos - p.pos) < ghost_hitbox_halfsize).all();
                             });
 
-                            if (it != time.ghosts.end())
+                            if (it != live_ghosts.end())
                             {
-                                for (std::size_t i = time.time - it->time_start; i < it->states.size(); i++)
-                                    it->states[i].dead = true;
+                                Ghost &ghost = time.ghosts[*it];
+                                ghost.states.Modify(time.time - ghost.time_start, [](Player &state)
+                                {
+                                    state.dead = true;
+                                    return true;
+                                });
 
                                 can_jump = true;
                                 using_doublejump = true;
@@ -754,14 +925,11 @@ namespace States
                 // Interaction with ghost shots.
                 if (controllable)
                 {
-                    for (Ghost &ghost : time.ghosts)
+                    for (int ghost_index : time.LiveGhosts())
                     {
-                        if (time.time < ghost.time_start)
-                            continue;
+                        Ghost &ghost = time.ghosts[ghost_index];
                         int rel_time = time.time - ghost.time_start;
-                        if (rel_time >= int(ghost.states.size()))
-                            continue;
-                        Player &state = ghost.states[rel_time];
+                        Player state = ghost.states[rel_time];
                         if (!state.shot)
                             continue;
                         if ((abs(state.shot->pos - p.pos) < Player::shot_hitbox_halfsize).all())
@@ -772,12 +940,13 @@ namespace States
                             p.remaining_boost_frames = 190;
 
                             // Erase this shot from the future.
-                            for (std::size_t i = rel_time; i < ghost.states.size(); i++)
+                            ghost.states.Modify(rel_time, [](Player &future_state)
                             {
-                                if (!ghost.states[i].shot)
-                                    break;
-                                ghost.states[i].shot.reset();
-                            }
+                                if (!future_state.shot)
+                                    return false;
+                                future_state.shot.reset();
+                                return true;
+                            });
                         }
                     }
                 }
@@ -946,8 +1115,8 @@ namespace States
                             {
                                 if (map.cells.pos_in_range(tile))
                                 {
-                                    map.at(tile).tile = Tile::air;
-                                    time.block_breaking_times[tile] = time.time;
+                                    map.SetTile(tile, Tile::air);
+                                    time.BreakBlock(tile);
 
                                     for (int i = 0; i < 15; i++)
                                     {
@@ -979,9 +1148,8 @@ namespace States
                 if (controllable)
                 {
                     // Spikes.
-                    for (ivec2 offset : p.spike_hitbox)
-                        if (map.at_pixel(p.pos + offset).info().kills)
-                            p.dead = true;
+                    if (map.AnyInPixelRect(map.killing_tiles, p.pos + p.spike_hitbox_a, p.pos + p.spike_hitbox_b))
+                        p.dead = true;
 
                     // Lava.
                     if (p.pos.y > p.lava_y + 4)
@@ -1061,7 +1229,7 @@ namespace States
             else if (time.shifting_now)
             {
                 // Try restoring the state from timeline.
-                if (const Player *state = time.FindNewestState())
+                if (std::optional<Player> state = time.FindNewestState())
                     p = *state;
 
                 buffered_jump = false;
@@ -1074,7 +1242,7 @@ namespace States
                 {
                     clamp_var_max(fade += 0.01f);
                     if (fade >= 1)
-                        next_state = "World{}";
+                        restart_queued = true;
                 }
                 else
                 {
@@ -1095,11 +1263,14 @@ namespace States
             { // Camera.
                 camera_pos = p.pos;
 
-                float audio_dist = 3;
+                if (audio_context)
+                {
+                    float audio_dist = 3;
 
-                Audio::Source::DefaultRefDistance(screen_size.x * audio_dist);
-                Audio::ListenerPosition(fvec3(0, 0, -screen_size.x * audio_dist));
-                Audio::ListenerOrientation(fvec3(0, 0, 1), fvec3(0, -1, 0));
+                    Audio::Source::DefaultRefDistance(screen_size.x * audio_dist);
+                    Audio::ListenerPosition(fvec3(0, 0, -screen_size.x * audio_dist));
+                    Audio::ListenerOrientation(fvec3(0, 0, 1), fvec3(0, -1, 0));
+                }
             }
         }
 
@@ -1111,7 +1282,7 @@ namespace States
             r.BindShader();
 
             { // Background.
-                static const auto &bg_region = texture_atlas.Get("bg.png");
+                const auto &bg_region = Graphics::AtlasRegion<"bg.png">();
 
                 constexpr float bg_speed_factor = 0.5f;
                 ivec2 bg_camera_pos = iround(camera_pos * bg_speed_factor);
@@ -1139,7 +1310,7 @@ namespace States
             }
 
             { // Prison.
-                static const auto &region = texture_atlas.Get("prison.png");
+                const auto &region = Graphics::AtlasRegion<"prison.png">();
                 static const ivec2 size = region.size with(y /= 2);
 
                 ivec2 prison_pos = map.player_start - camera_pos;
@@ -1150,8 +1321,8 @@ namespace States
             }
 
             { // Abilities and secrets.
-                static const auto &reg_ability = texture_atlas.Get("ability.png");
-                static const auto &reg_secret = texture_atlas.Get("secret.png");
+                const auto &reg_ability = Graphics::AtlasRegion<"ability.png">();
+                const auto &reg_secret = Graphics::AtlasRegion<"secret.png">();
 
                 constexpr int offset_array[] = {0, -1, -1, -1, 0, 1, 1, 1};
                 constexpr int offset_len = 20;
@@ -1162,9 +1333,6 @@ namespace States
                     if (!pos)
                         return;
                     ivec2 screen_pos = *pos - camera_pos;
-                    if ((abs(screen_pos) > screen_size / 2 + 16).any())
-                        return;
-
                     r.iquad(screen_pos with(y += offset), region).center();
                 };
                 DrawPowerup(reg_ability, map.ability_timeshift);
@@ -1176,14 +1344,13 @@ namespace States
             }
 
             { // Shots.
-                static const auto &region = texture_atlas.Get("shot.png");
+                const auto &region = Graphics::AtlasRegion<"shot.png">();
                 static const int size = region.size.y;
 
                 if (p.shot)
                 {
                     fvec2 rel_pos = p.shot->pos - camera_pos;
-                    if ((rel_pos <= screen_size / 2 + 16).all())
-                        r.fquad(rel_pos, region.region(ivec2(size * Shot::GetAnimVariant(time.time), 0), ivec2(size))).center().flip_x(p.shot->vel.x < 0);
+                    r.fquad(rel_pos, region.region(ivec2(size * Shot::GetAnimVariant(time.time), 0), ivec2(size))).center().flip_x(p.shot->vel.x < 0);
                 }
             }
 
@@ -1192,7 +1359,7 @@ namespace States
             }
 
             { // Player.
-                static const auto &pl_region = texture_atlas.Get("player.png");
+                const auto &pl_region = Graphics::AtlasRegion<"player.png">();
                 constexpr ivec2 pl_size(36);
 
                 float alpha = p.in_prison ? 0 : clamp_min(1 - p.death_timer / 10.f);
@@ -1202,7 +1369,7 @@ namespace States
             }
 
             { // Lava.
-                static const auto &lava_region = texture_atlas.Get("lava.png");
+                const auto &lava_region = Graphics::AtlasRegion<"lava.png">();
 
                 int anim_x = time.time / 4 % lava_region.size.x;
 
@@ -1269,19 +1436,13 @@ namespace States
                         int remaining = time.RemainingShifts();
                         float alpha = smoothstep(clamp_max(time_since_got_timeshift / 60.f));
 
-                        Graphics::Text text(Fonts::main, FMT("{}", remaining));
-                        for (int i = 0; i < 4; i++)
-                            r.itext(ivec2(0, -screen_size.y/2) + ivec2::dir4(i), text).align(ivec2(0,-1)).alpha(alpha).color(fvec3(0));
-                        r.itext(ivec2(0, -screen_size.y/2), text).align(ivec2(0,-1)).alpha(alpha).color(remaining == 0 ? fvec3(1, window.Ticks() / 60 % 2, 0) : fvec3(255, 179, 26) / 255);
+                        r.itext(ivec2(0, -screen_size.y/2), Fonts::main, FMT("{}", remaining)).align(ivec2(0,-1)).alpha(alpha).color(remaining == 0 ? fvec3(1, window.Ticks() / 60 % 2, 0) : fvec3(255, 179, 26) / 255).outline(fvec3(0));
                     }
 
                     // Remaining secrets.
                     if (int(map.secrets.size()) < map.num_secrets)
                     {
-                        Graphics::Text text(Fonts::main, FMT("{}/{}", map.num_secrets - int(map.secrets.size()), map.num_secrets));
-                        for (int i = 0; i < 4; i++)
-                            r.itext(ivec2(screen_size.x/2 - 1, -screen_size.y/2) + ivec2::dir4(i), text).align(ivec2(1,-1)).alpha(1).color(fvec3(0));
-                        r.itext(ivec2(screen_size.x/2 - 1, -screen_size.y/2), text).align(ivec2(1,-1)).alpha(1).color(fvec3(102, 252, 255) / 255);
+                        r.itext(ivec2(screen_size.x/2 - 1, -screen_size.y/2), Fonts::main, FMT("{}/{}", map.num_secrets - int(map.secrets.size()), map.num_secrets)).align(ivec2(1,-1)).alpha(1).color(fvec3(102, 252, 255) / 255).outline(fvec3(0));
                     }
                 }
 
@@ -1291,12 +1452,8 @@ namespace States
                         if (t < 0.001f)
                             return;
 
-                        Graphics::Text text(Fonts::main, message);
                         float alpha = smoothstep(clamp(t));
-
-                        for (int i = 0; i < 4; i++)
-                            r.itext(ivec2(0, screen_size.y/2 - 1) + ivec2::dir4(i), text).align_y(1).alpha(alpha).color(fvec3(0));
-                        r.itext(ivec2(0, screen_size.y/2 - 1), text).align_y(1).alpha(alpha).color(fvec3(255, 179, 26) / 255);
+                        r.itext(ivec2(0, screen_size.y/2 - 1), Fonts::main, std::string(message)).align_y(1).alpha(alpha).color(fvec3(255, 179, 26) / 255).outline(fvec3(0));
                     };
 
                     ShowHint("Hold [Z]/[L] to travel back in time", hint_death_hollback);
@@ -1350,7 +1507,7 @@ namespace States
             { // Menu logo and author info.
                 if (logo_alpha > 0.001f)
                 {
-                    static const auto &region = texture_atlas.Get("logo.png");
+                    const auto &region = Graphics::AtlasRegion<"logo.png">();
                     r.iquad(ivec2(0, -52), region).center().alpha(smoothstep(logo_alpha));
 
                     r.itext(ivec2(0, screen_size.y/2 - 28), Graphics::Text(Fonts::main, FMT("by HolyBlackCat for LD50, v1.{}", build_number)))
@@ -1364,7 +1521,7 @@ namespace States
             }
 
             { // Vignette.
-                static const auto &region = texture_atlas.Get("vignette.png");
+                const auto &region = Graphics::AtlasRegion<"vignette.png">();
                 r.iquad(ivec2(), region).alpha(vignette_alpha).center();
             }
 
@@ -1372,3 +1529,195 @@ namespace States
         }
     };
 }
+
+namespace Benchmarks
+{
+    void GhostTimeline()
+    {
+        // Generate a plausible player trajectory. It doesn't have to be exact, it just needs to change in roughly the same ways.
+        std::vector<Player> source;
+        {
+            constexpr int num_ticks = 60 * 60 * 10; // 10 minutes.
+
+            Random::DefaultGenerator gen(42);
+            Random::DefaultInterfaces<Random::DefaultGenerator> bra(gen);
+
+            Player p;
+            p.in_prison = false;
+            p.lava_y = 1000;
+            int input_dir = 0, input_timer = 0;
+
+            for (int i = 0; i < num_ticks; i++)
+            {
+                if (input_timer-- <= 0)
+                {
+                    input_dir = -1 <= bra.i <= 1;
+                    input_timer = 20 <= bra.i <= 60;
+                }
+
+                p.prev_ground = p.ground;
+                p.ground = p.pos.y >= 0;
+                if (p.ground)
+                {
+                    p.pos.y = 0;
+                    p.vel.y = (bra.f <= 1) < 0.03f ? -3.56f : 0;
+                }
+                else
+                {
+                    p.vel.y += 0.1f;
+                }
+                p.prev_vel = p.vel;
+
+                if (input_dir && p.vel.x * input_dir < 1.5f)
+                    p.vel.x = clamp_max(p.vel.x * input_dir + 0.4f, 1.5f) * input_dir;
+                else
+                    p.vel.x = clamp_min(abs(p.vel.x) - 0.2f, 0) * sign(p.vel.x);
+                if (input_dir)
+                    p.facing_left = input_dir < 0;
+                p.is_walking = input_dir && p.ground;
+                p.walking_timer = p.is_walking ? p.walking_timer + 1 : 0;
+
+                fvec2 eff_vel = p.vel + p.vel_lag;
+                ivec2 int_vel = iround(eff_vel);
+                p.vel_lag = (eff_vel - int_vel) * 0.99f;
+                p.pos += int_vel;
+
+                if (!p.shot && (bra.f <= 1) < 0.01f)
+                {
+                    p.shot.emplace();
+                    p.shot->pos = p.pos;
+                    p.shot->vel = fvec2(p.facing_left ? -2 : 2, 0);
+                }
+                else if (p.shot)
+                {
+                    p.shot->pos += p.shot->vel;
+                    if (abs(p.shot->pos.x - p.pos.x) > 200)
+                        p.shot.reset();
+                }
+
+                p.anim_state = !p.ground ? 2 : p.is_walking;
+                p.anim_variant = p.is_walking ? p.walking_timer / 8 % 4 : i / 20 % 3;
+                if (i % 9 == 0)
+                    p.lava_y -= 1;
+
+                source.push_back(p);
+            }
+        }
+
+        int n = source.size();
+
+        std::uint64_t checksum = 0;
+        auto Touch = [&](const Player &p)
+        {
+            checksum += p.pos.x + p.pos.y * 3 + p.anim_variant + p.shot.has_value();
+        };
+
+        auto Measure = [&](auto &&func) -> double
+        {
+            std::uint64_t start = Clock::Time();
+            func();
+            return Clock::TicksToSeconds(Clock::Time() - start) * 1e9 / n;
+        };
+
+        std::vector<Player> vec;
+        DeltaTimeline<PlayerTimelineCodec> timeline;
+
+        double vec_append = Measure([&]{for (const Player &p : source) vec.push_back(p);});
+        double tl_append = Measure([&]{for (const Player &p : source) timeline.PushBack(p);});
+
+        double vec_seq = Measure([&]{for (int i = 0; i < n; i++) Touch(vec[i]);});
+        double tl_seq = Measure([&]{for (int i = 0; i < n; i++) Touch(timeline[i]);});
+
+        double vec_rev = Measure([&]{for (int i = n; i-- > 0;) Touch(vec[i]);});
+        double tl_rev = Measure([&]{for (int i = n; i-- > 0;) Touch(timeline[i]);});
+
+        // This mimics `RenderGhosts()`, which looks at the current state, and then at 3 states before and after it.
+        auto GhostPattern = [&](auto &&get)
+        {
+            for (int t = 3; t < n - 3; t++)
+            {
+                Touch(get(t));
+                for (int i = -3; i <= 3; i++)
+                    Touch(get(t + i));
+            }
+        };
+        double vec_ghost = Measure([&]{GhostPattern([&](int i) -> const Player & {return vec[i];});});
+        double tl_ghost = Measure([&]{GhostPattern([&](int i){return timeline[i];});});
+
+        Random::DefaultGenerator index_gen(43);
+        std::vector<int> random_indices(n);
+        for (int &index : random_indices)
+            index = std::uniform_int_distribution<int>(0, n - 1)(index_gen);
+        double vec_random = Measure([&]{for (int index : random_indices) Touch(vec[index]);});
+        double tl_random = Measure([&]{for (int index : random_indices) Touch(timeline[index]);});
+
+        // Verify.
+        for (int i = 0; i < n; i++)
+        {
+            Player a = timeline[i];
+            const Player &b = source[i];
+            if (a.pos != b.pos || a.vel != b.vel || a.vel_lag != b.vel_lag || a.lava_y != b.lava_y || a.shot.has_value() != b.shot.has_value() || a.facing_left != b.facing_left || a.walking_timer != b.walking_timer)
+                Program::Error("Ghost timeline benchmark: decoded state ", i, " doesn't match the original.");
+        }
+
+        std::size_t vec_bytes = vec.capacity() * sizeof(Player);
+        std::size_t tl_bytes = timeline.MemoryUsage();
+
+        std::cout << FMT("Ghost timeline, {} states (sizeof(Player) = {}):\n", n, sizeof(Player));
+        std::cout << FMT("                      {:>16} {:>16}\n", "std::vector", "DeltaTimeline");
+        std::cout << FMT("  memory, bytes/state {:>16.2f} {:>16.2f}\n", vec_bytes / double(n), tl_bytes / double(n));
+        std::cout << FMT("  append, ns/state    {:>16.2f} {:>16.2f}\n", vec_append, tl_append);
+        std::cout << FMT("  sequential, ns      {:>16.2f} {:>16.2f}\n", vec_seq, tl_seq);
+        std::cout << FMT("  reverse, ns         {:>16.2f} {:>16.2f}\n", vec_rev, tl_rev);
+        std::cout << FMT("  ghost pattern, ns   {:>16.2f} {:>16.2f}\n", vec_ghost, tl_ghost);
+        std::cout << FMT("  random, ns          {:>16.2f} {:>16.2f}\n", vec_random, tl_random);
+        std::cout << FMT("  (checksum {})\n", checksum);
+    }
+
+    void WorldSnapshot()
+    {
+        if (!controls_source)
+            controls_source = std::make_unique<RandomControls>(0);
+
+        constexpr int num_runs = 20;
+
+        auto Measure = [&](auto &&func) -> double
+        {
+            std::uint64_t start = Clock::Time();
+            for (int i = 0; i < num_runs; i++)
+                func();
+            return Clock::TicksToSeconds(Clock::Time() - start) * 1e3 / num_runs;
+        };
+
+        double construct_ms = Measure([&]{States::World world;});
+
+        std::cout << FMT("World snapshot (average of {} runs):\n", num_runs);
+        std::cout << FMT("  construct from map.json, ms {:>10.3f}\n", construct_ms);
+
+        States::World world;
+        int ticks_done = 0;
+        for (int target_ticks : {0, 60 * 60, 60 * 60 * 10})
+        {
+            for (; ticks_done < target_ticks; ticks_done++)
+            {
+                std::string next_state;
+                world.Tick(next_state);
+            }
+
+            std::vector<unsigned char> snapshot;
+            double save_ms = Measure([&]{snapshot = world.SaveSnapshot();});
+            double load_ms = Measure([&]{world.LoadSnapshot(Stream::ReadOnlyData::mem_reference(snapshot));});
+
+            // Verify.
+            if (world.SaveSnapshot() != snapshot)
+                Program::Error("World snapshot benchmark: the restored world doesn't match the original.");
+
+            std::size_t raw_size = Archive::UncompressedSize(snapshot.data(), snapshot.data() + snapshot.size());
+
+            std::cout << FMT("  after {} ticks:\n", ticks_done);
+            std::cout << FMT("    size, bytes              {:>10} ({} uncompressed)\n", snapshot.size(), raw_size);
+            std::cout << FMT("    save, ms                 {:>10.3f}\n", save_ms);
+            std::cout << FMT("    load, ms                 {:>10.3f}\n", load_ms);
+        }
+    }
+}
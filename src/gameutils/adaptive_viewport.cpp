@@ -1,7 +1,16 @@
 #include "adaptive_viewport.h"
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "graphics/clear.h"
 #include "graphics/framebuffer.h"
+#include "graphics/image.h"
 #include "graphics/shader.h"
 #include "graphics/texture.h"
 #include "graphics/vertex_buffer.h"
@@ -44,6 +53,138 @@ namespace GameUtils
         Graphics::TexUnit tex_unit;
         Graphics::FrameBuffer fbuf, fbuf_intermediate;
         Graphics::VertexBuffer<ShaderAttribs> vertex_buf;
+
+        // Saves the captured frames to files on a separate thread.
+        class Capture
+        {
+            struct Frame
+            {
+                Graphics::Image image;
+                std::string file_name;
+            };
+
+            std::string file_prefix;
+            int max_images = 0;
+            int image_count = 0; // The number of images allocated so far, free or not.
+            int next_frame_index = 0;
+
+            std::mutex mutex;
+            std::condition_variable cond_var; // Notified when `pending` or `free_images` grow, and when `stop` is set.
+            std::vector<Graphics::Image> free_images;
+            std::deque<Frame> pending;
+            bool stop = false;
+            std::string error; // The first error that happened on the worker thread.
+
+            std::thread thread; // This goes last, to be started after everything else is constructed.
+
+            void WorkerFunc()
+            {
+                std::unique_lock lock(mutex);
+                while (true)
+                {
+                    cond_var.wait(lock, [&]{return stop || !pending.empty();});
+                    if (pending.empty())
+                        return; // Stop only after everything is saved.
+
+                    Frame frame = std::move(pending.front());
+                    pending.pop_front();
+
+                    lock.unlock();
+                    std::string new_error;
+                    try
+                    {
+                        frame.image.FlipY();
+                        frame.image.Save(frame.file_name);
+                    }
+                    catch (std::exception &e)
+                    {
+                        new_error = e.what();
+                    }
+                    lock.lock();
+
+                    if (error.empty())
+                        error = std::move(new_error);
+                    free_images.push_back(std::move(frame.image));
+                    cond_var.notify_all();
+                }
+            }
+
+            // Waits for the pending frames to be saved, and stops the thread.
+            void Stop()
+            {
+                if (!thread.joinable())
+                    return;
+                {
+                    std::lock_guard lock(mutex);
+                    stop = true;
+                }
+                cond_var.notify_all();
+                thread.join();
+            }
+
+            // Must be called with the mutex locked.
+            void ThrowIfFailed()
+            {
+                if (!error.empty())
+                    Program::Error("Unable to save a captured frame: ", error);
+            }
+
+          public:
+            Capture(std::string file_prefix, int max_images)
+                : file_prefix(std::move(file_prefix)), max_images(max_images), thread([this]{WorkerFunc();})
+            {}
+
+            Capture(const Capture &) = delete;
+            Capture &operator=(const Capture &) = delete;
+
+            ~Capture()
+            {
+                Stop();
+            }
+
+            // Returns an image of the specified size to read a frame into.
+            // Reuses the images that were already saved. Blocks only if `max_images` images are waiting to be saved.
+            [[nodiscard]] Graphics::Image AcquireImage(ivec2 size)
+            {
+                std::unique_lock lock(mutex);
+                ThrowIfFailed();
+
+                if (free_images.empty() && image_count < max_images)
+                {
+                    image_count++;
+                    lock.unlock();
+                    return Graphics::Image(size);
+                }
+
+                cond_var.wait(lock, [&]{return !free_images.empty();});
+                Graphics::Image ret = std::move(free_images.back());
+                free_images.pop_back();
+                lock.unlock();
+
+                if (ret.Size() != size)
+                    ret = Graphics::Image(size);
+                return ret;
+            }
+
+            // Queues an image with a bottom-up pixel order, as returned by `glReadPixels()`.
+            void Submit(Graphics::Image image)
+            {
+                {
+                    std::lock_guard lock(mutex);
+                    pending.push_back({std::move(image), FMT("{}{:06}.png", file_prefix, next_frame_index++)});
+                }
+                cond_var.notify_all();
+            }
+
+            // Waits for the pending frames to be saved. Throws if any of them couldn't be saved.
+            void Finish()
+            {
+                Stop();
+                std::lock_guard lock(mutex);
+                ThrowIfFailed();
+            }
+        };
+        std::unique_ptr<Capture> capture;
     };
 
     AdaptiveViewport::AdaptiveViewport() {}
@@ -104,6 +245,22 @@ namespace GameUtils
 
     void AdaptiveViewport::FinishFrame(const Graphics::FrameBuffer *fbuf)
     {
+        if (data->capture)
+        {
+            ivec2 size = data->details.Size();
+            Graphics::Image image = data->capture->AcquireImage(size);
+            #ifdef GL_READ_FRAMEBUFFER
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, data->fbuf.Handle());
+            #else
+            data->fbuf.Bind();
+            #endif
+            glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, image.Data());
+            #ifdef GL_READ_FRAMEBUFFER
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            #endif
+            data->capture->Submit(std::move(image));
+        }
+
         data->shader.Bind();
 
         data->fbuf_intermediate.Bind();
@@ -121,6 +278,26 @@ namespace GameUtils
         data->vertex_buf.Draw(Graphics::triangles);
     }
 
+    void AdaptiveViewport::StartCapture(std::string file_prefix, int max_images)
+    {
+        ASSERT(max_images >= 1, "Adaptive viewport: Need at least one image to capture frames.");
+        StopCapture();
+        data->capture = std::make_unique<Data::Capture>(std::move(file_prefix), max_images);
+    }
+
+    void AdaptiveViewport::StopCapture()
+    {
+        if (!data->capture)
+            return;
+        auto capture = std::move(data->capture);
+        capture->Finish();
+    }
+
+    bool AdaptiveViewport::IsCapturing() const
+    {
+        return bool(data->capture);
+    }
+
     Graphics::FrameBuffer &AdaptiveViewport::GetFrameBuffer()
     {
         return data->fbuf;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 #include "utils/mat.h"
 
@@ -139,6 +140,14 @@ namespace GameUtils
         // Rescales and outputs the frame to the passed framebuffer.
         void FinishFrame(const Graphics::FrameBuffer *fbuf = 0);
 
+        // Starts saving every frame to `<file_prefix><frame index>.png`, starting from index 0, at the source resolution.
+        // The frames are read back in `FinishFrame()` and saved on a separate thread, reusing up to `max_images` image buffers.
+        // `FinishFrame()` blocks only if all of them are still waiting to be saved.
+        void StartCapture(std::string file_prefix, int max_images = 8);
+        // Waits for the remaining frames to be saved. Throws if any of the frames couldn't be saved.
+        void StopCapture();
+        [[nodiscard]] bool IsCapturing() const;
+
         // Returns the internal framebuffer.
         // It's bound by default when you call `BeginFrame()`.
         [[nodiscard]] Graphics::FrameBuffer &GetFrameBuffer();
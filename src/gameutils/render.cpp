@@ -1,6 +1,11 @@
 #include "render.h"
 
 #include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
 
 #include "graphics/complete.h"
 #include "reflection/structs.h"
@@ -33,6 +38,50 @@ void main()
     v_factors   = a_factors;
 })";
 
+    // The instanced backend draws each quad as an instance of a 6-vertex mesh, and reads the quad parameters from a buffer texture.
+    // We don't use per-instance attributes, since `glVertexAttribDivisor()` needs GL 3.3, and we target 3.2. Buffer textures are in 3.1.
+    // Each quad takes 4 vectors: `(pos, edge_x)`, `(edge_y, tex_pos)`, `(tex_size, mix, beta)`, `(color, alpha)`, where `pos` is the first corner,
+    //   and `edge_x`, `edge_y` point from it to the two adjacent corners. `mix` is negative for quads without a texture.
+    // The batch size is chosen to fit into the minimal buffer texture size that GL 3.2 guarantees (65536 texels).
+    static constexpr int instance_batch_size = 0x2000;
+
+    REFL_SIMPLE_STRUCT( InstanceAttribs
+        REFL_DECL(fvec2) corner
+    )
+
+    REFL_SIMPLE_STRUCT( InstancedUniforms
+        REFL_DECL(Graphics::Uniform<fmat4> REFL_ATTR Graphics::Vert) matrix
+        REFL_DECL(Graphics::Uniform<fvec2> REFL_ATTR Graphics::Vert) tex_size
+        REFL_DECL(Graphics::Uniform<Graphics::TexUnit> REFL_ATTR Graphics::Frag) texture
+        REFL_DECL(Graphics::Uniform<fmat4> REFL_ATTR Graphics::Frag) color_matrix
+        REFL_DECL(Graphics::Uniform<Graphics::BufferTexture> REFL_ATTR Graphics::Vert) instances
+    )
+
+    static constexpr const char *instanced_vertex_source = R"(
+varying vec4 v_color;
+varying vec2 v_texcoord;
+varying vec3 v_factors;
+void main()
+{
+    int i = gl_InstanceID * 4;
+    vec4 a = texelFetch(u_instances, i);
+    vec4 b = texelFetch(u_instances, i+1);
+    vec4 c = texelFetch(u_instances, i+2);
+    vec4 d = texelFetch(u_instances, i+3);
+    gl_Position = u_matrix * vec4(a.xy + a.zw * a_corner.x + b.xy * a_corner.y, 0, 1);
+    v_texcoord  = (b.zw + c.xy * a_corner) / u_tex_size;
+    if (c.z < 0)
+    {
+        v_color   = d;
+        v_factors = vec3(0, 0, c.w);
+    }
+    else
+    {
+        v_color   = vec4(d.rgb, 0);
+        v_factors = vec3(c.z, d.a, c.w);
+    }
+})";
+
     static constexpr const char *fragment_source = R"(
 varying vec4 v_color;
 varying vec2 v_texcoord;
@@ -48,23 +97,472 @@ void main()
     gl_FragColor.a *= v_factors.z;
 })";
 
-    Graphics::SimpleRenderQueue<Attribs, 3> queue; // Note that the queue has to be the first field.
+    Backend backend = Backend::triangles;
+
+    Graphics::SimpleRenderQueue<Attribs, 4> queue; // Quads. Triangles are added as degenerate quads.
     Uniforms uni;
     Graphics::Shader shader;
 
-    Data(std::size_t queue_size, const Graphics::ShaderConfig &config) : queue(queue_size), shader("Main", config, Graphics::ShaderPreferences{}, Meta::tag<Attribs>{}, uni, vertex_source, fragment_source) {}
+    // Those are only used with `Backend::instanced`.
+    InstancedUniforms instanced_uni;
+    Graphics::Shader instanced_shader;
+    Graphics::VertexBuffer<InstanceAttribs> instance_corners;
+    Graphics::BufferTexture instance_buffer;
+    std::vector<fvec4> instances; // `instance_batch_size * 4` vectors.
+    int instance_count = 0;
+
+    // The values of the uniforms that are set with `Set...()` functions.
+    struct State
+    {
+        int texture_index = -1; // A texture unit index, or -1 if not set yet.
+        ivec2 tex_size = ivec2(0);
+        fmat4 matrix;
+        fmat4 color_matrix;
+
+        [[nodiscard]] bool operator==(const State &other) const
+        {
+            return texture_index == other.texture_index && tex_size == other.tex_size && SameMatrix(matrix, other.matrix) && SameMatrix(color_matrix, other.color_matrix);
+        }
+
+        [[nodiscard]] static bool SameMatrix(const fmat4 &a, const fmat4 &b)
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+        }
+    };
+
+    State state; // The state set by the user.
+    State applied; // The state currently stored in the uniforms. In the deferred mode, it can be different from `state`.
+    bool applied_valid = false; // If false, `applied` is meaningless, and all uniforms must be set.
+
+    // The visible area, in the coordinates before `state.matrix` is applied. Computed from `state.matrix`.
+    fvec2 view_min, view_max;
+
+    // The deferred mode, see `Render::SetDeferred()`.
+    struct DeferredQuad
+    {
+        int layer = 0;
+        int state = 0; // An index in `deferred_states`.
+        bool is_triangle = false; // If true, the last corner is ignored.
+        const Mesh *mesh = nullptr; // If not null, this is a `DrawMesh()` call, and `mesh_offset` is used instead of `corners`.
+        fvec2 mesh_offset;
+        Attribs corners[4];
+    };
+    bool deferred = false;
+    int layer = 0;
+    std::vector<State> deferred_states; // Unique states used by `deferred_quads`.
+    int deferred_state_index = -1; // The index of `state` in `deferred_states`, or -1 if it's not known yet.
+    std::vector<DeferredQuad> deferred_quads; // Quads, triangles and meshes.
+    std::vector<int> deferred_order; // A temporary buffer for sorting `deferred_quads`.
+
+    // Text layouts, see `LayoutText()`. The key is (font, alignment x, alignment y, box alignment x, string).
+    // The cache is cleared when it gets too large, since the strings could be arbitrary.
+    // A layout is rebuilt if the font's glyphs version changes, which happens when the glyph cache moves glyphs around.
+    static constexpr std::size_t max_cached_text_layouts = 512;
+    struct TextLayout
+    {
+        int glyphs_version = 0; // `Font::GlyphsVersion()` before the layout was built.
+        std::vector<Sprite> sprites;
+        std::vector<uint32_t> glyph_func_chars; // Unique characters not inserted into the font, they come from the glyph func. Usually empty.
+    };
+    std::map<std::tuple<const Graphics::Font *, int, int, int, std::string>, TextLayout> text_layouts;
+    // A temporary buffer for drawing text.
+    std::vector<Sprite> text_sprites;
+    // See `Render::SpriteBuffer()`.
+    std::vector<Sprite> sprite_buffer;
+
+    // Not null between `BeginMesh()` and `EndMesh()`.
+    Mesh *target_mesh = nullptr;
+    std::vector<Attribs> mesh_vertices;
+
+    Data(std::size_t queue_size, const Graphics::ShaderConfig &config, Backend backend)
+        : backend(backend), queue(queue_size), shader("Main", config, Graphics::ShaderPreferences{}, Meta::tag<Attribs>{}, uni, vertex_source, fragment_source)
+    {
+        if (backend == Backend::instanced)
+        {
+            instanced_shader = Graphics::Shader("Main instanced", config, Graphics::ShaderPreferences{}, Meta::tag<InstanceAttribs>{}, instanced_uni, instanced_vertex_source, fragment_source);
+
+            // Same order as in `SimpleRenderQueue::Add()`.
+            InstanceAttribs corners[6] = {{fvec2(0,0)}, {fvec2(1,0)}, {fvec2(0,1)}, {fvec2(0,1)}, {fvec2(1,0)}, {fvec2(1,1)}};
+            instance_corners = Graphics::VertexBuffer<InstanceAttribs>(6, corners);
+
+            instance_buffer = Graphics::BufferTexture(GL_RGBA32F);
+            instances.resize(instance_batch_size * 4);
+            instanced_uni.instances = instance_buffer;
+
+            shader.Bind();
+        }
+    }
+
+    // Sets the uniforms that differ from `applied`. Must be called when nothing is queued.
+    void ApplyState(const State &target)
+    {
+        if (target.texture_index != -1 && (!applied_valid || target.texture_index != applied.texture_index))
+            SetUniforms([&](auto &u){u.texture.set(&target.texture_index, 1);});
+        if (!applied_valid || target.tex_size != applied.tex_size)
+            SetUniforms([&](auto &u){u.tex_size = target.tex_size;});
+        if (!applied_valid || !State::SameMatrix(target.matrix, applied.matrix))
+            SetUniforms([&](auto &u){u.matrix = target.matrix;});
+        if (!applied_valid || !State::SameMatrix(target.color_matrix, applied.color_matrix))
+            SetUniforms([&](auto &u){u.color_matrix = target.color_matrix;});
+        applied = target;
+        applied_valid = true;
+    }
+
+    // Should be called after changing `state`.
+    void StateChanged()
+    {
+        if (deferred)
+        {
+            deferred_state_index = -1;
+        }
+        else
+        {
+            FlushQueue();
+            FlushInstances();
+            ApplyState(state);
+        }
+    }
+
+    // Returns the index of `state` in `deferred_states`, adding it if necessary.
+    [[nodiscard]] int CurrentDeferredState()
+    {
+        if (deferred_state_index == -1)
+        {
+            auto it = std::find(deferred_states.begin(), deferred_states.end(), state);
+            deferred_state_index = int(it - deferred_states.begin());
+            if (it == deferred_states.end())
+                deferred_states.push_back(state);
+        }
+        return deferred_state_index;
+    }
+
+    void AddDeferredQuad(const Attribs &a, const Attribs &b, const Attribs &c, const Attribs &d, bool is_triangle = false)
+    {
+        DeferredQuad &quad = deferred_quads.emplace_back();
+        quad.layer = layer;
+        quad.state = CurrentDeferredState();
+        quad.is_triangle = is_triangle;
+        quad.corners[0] = a;
+        quad.corners[1] = b;
+        quad.corners[2] = c;
+        quad.corners[3] = d;
+    }
+
+    // Expands the sprites directly into the deferred quads, skipping the ones outside of the view.
+    void AddDeferredSprites(std::span<const Sprite> sprites)
+    {
+        int state_index = CurrentDeferredState();
+        std::size_t written = 0;
+        for (const Sprite &sprite : sprites)
+        {
+            DeferredQuad &quad = deferred_quads.emplace_back();
+            if (ExpandSprites({&sprite, 1}, quad.corners, true) == 0)
+            {
+                deferred_quads.pop_back();
+                continue;
+            }
+            quad.layer = layer;
+            quad.state = state_index;
+            written++;
+        }
+        CountSprites(sprites.size(), written);
+    }
+
+    void AddDeferredMesh(const Mesh &mesh, fvec2 offset)
+    {
+        DeferredQuad &quad = deferred_quads.emplace_back();
+        quad.layer = layer;
+        quad.state = CurrentDeferredState();
+        quad.mesh = &mesh;
+        quad.mesh_offset = offset;
+    }
+
+    // Draws the deferred quads sorted by layer, preserving the order within each layer. Changes the state only when necessary.
+    void FlushDeferred()
+    {
+        if (deferred_quads.empty())
+            return;
+
+        deferred_order.resize(deferred_quads.size());
+        for (std::size_t i = 0; i < deferred_order.size(); i++)
+            deferred_order[i] = int(i);
+        std::stable_sort(deferred_order.begin(), deferred_order.end(), [&](int a, int b){return deferred_quads[a].layer < deferred_quads[b].layer;});
+
+        // Temporarily disable the deferred mode to draw the quads normally.
+        deferred = false;
+        int cur_state = -1;
+        for (int index : deferred_order)
+        {
+            const DeferredQuad &quad = deferred_quads[index];
+            if (quad.state != cur_state)
+            {
+                cur_state = quad.state;
+                FlushQueue();
+                FlushInstances();
+                ApplyState(deferred_states[cur_state]);
+            }
+            // Those were already counted when they were added.
+            if (quad.mesh)
+                DrawMeshNow(*quad.mesh, quad.mesh_offset);
+            else if (quad.is_triangle)
+                QueueTriangle(quad.corners[0], quad.corners[1], quad.corners[2]);
+            else
+                QueueQuad(quad.corners[0], quad.corners[1], quad.corners[2], quad.corners[3]);
+        }
+        FlushQueue();
+        FlushInstances();
+        ApplyState(state);
+        deferred = true;
+
+        deferred_quads.clear();
+        deferred_states.clear();
+        deferred_state_index = -1;
+    }
+
+    // Calls `func(uniforms)` for `uni`, and for `instanced_uni` if it's used.
+    // The main shader remains bound.
+    template <typename F>
+    void SetUniforms(F &&func)
+    {
+        if (backend == Backend::instanced)
+            func(instanced_uni);
+        func(uni);
+    }
+
+    void FlushQueue()
+    {
+        if (queue.Pos() == 0)
+            return;
+        shader.Bind();
+        queue.Flush();
+    }
+
+    void FlushInstances()
+    {
+        if (instance_count == 0)
+            return;
+        instance_buffer.SetData(instance_count * 4 * sizeof(fvec4), instances.data());
+        instanced_shader.Bind();
+        instance_corners.DrawInstanced(Graphics::triangles, 6, instance_count);
+
+        Graphics::RenderCounters &counters = Graphics::GlobalRenderCounters::value;
+        counters.flushes++;
+        counters.bytes += instance_count * 4 * sizeof(fvec4);
+
+        instance_count = 0;
+        shader.Bind();
+    }
+
+    // Returns a place for a single instance, 4 vectors.
+    [[nodiscard]] fvec4 *AddInstance()
+    {
+        FlushQueue();
+        if (instance_count == instance_batch_size)
+            FlushInstances();
+        return instances.data() + 4 * instance_count++;
+    }
+
+    // Tries to add a quad as an instance. Fails if the corners have different colors or blending factors.
+    // The corners must form a parallelogram with an axis-aligned texture rectangle, which is always true for `Quad_t`.
+    [[nodiscard]] bool TryAddQuadInstance(const Attribs &a, const Attribs &b, const Attribs &c, const Attribs &d)
+    {
+        if (a.color != b.color || a.color != c.color || a.color != d.color || a.factors != b.factors || a.factors != c.factors || a.factors != d.factors)
+            return false;
+
+        // See `Quad_t` for how the attributes are computed with and without a texture.
+        bool has_texture = a.factors.x != 0 || a.factors.y != 0;
+        if (has_texture && a.color.a != 0)
+            return false;
+
+        fvec4 *out = AddInstance();
+        out[0] = fvec4(a.pos.x, a.pos.y, b.pos.x - a.pos.x, b.pos.y - a.pos.y);
+        out[1] = fvec4(d.pos.x - a.pos.x, d.pos.y - a.pos.y, a.texcoord.x, a.texcoord.y);
+        out[2] = fvec4(c.texcoord.x - a.texcoord.x, c.texcoord.y - a.texcoord.y, has_texture ? a.factors.x : -1, a.factors.z);
+        out[3] = a.color.to_vec3().to_vec4(has_texture ? a.factors.y : a.color.a);
+        return true;
+    }
+
+    // Draws a mesh using the applied state, after drawing everything that's queued. Doesn't update the counters.
+    void DrawMeshNow(const Mesh &mesh, fvec2 offset);
+
+    // Sends a triangle to the queue, bypassing the mesh recording and the deferred mode.
+    void QueueTriangle(const Attribs &a, const Attribs &b, const Attribs &c)
+    {
+        FlushInstances();
+        queue.Add(a, b, c, c); // The second triangle of this quad has zero area.
+    }
+
+    // Sends a quad to the queue or to the instance buffer, bypassing the mesh recording and the deferred mode.
+    void QueueQuad(const Attribs &a, const Attribs &b, const Attribs &c, const Attribs &d)
+    {
+        if (backend != Backend::instanced || !TryAddQuadInstance(a, b, c, d))
+        {
+            FlushInstances();
+            queue.Add(a, b, c, d);
+        }
+    }
+
+    void AddTriangle(const Attribs &a, const Attribs &b, const Attribs &c)
+    {
+        if (target_mesh)
+        {
+            // Counted when the mesh is drawn.
+            mesh_vertices.push_back(a);
+            mesh_vertices.push_back(b);
+            mesh_vertices.push_back(c);
+            return;
+        }
+
+        Graphics::GlobalRenderCounters::value.triangles++;
+        if (deferred)
+            AddDeferredQuad(a, b, c, c, true);
+        else
+            QueueTriangle(a, b, c);
+    }
+
+    // Returns true if a quad with those bounds is fully outside of the view, and increments the counter in this case.
+    // Never culls when recording a mesh, since it can be drawn with a different matrix.
+    [[nodiscard]] bool CullQuad(fvec2 min, fvec2 max)
+    {
+        if (target_mesh || ((max >= view_min).all() && (min <= view_max).all()))
+            return false;
+        Graphics::GlobalRenderCounters::value.culled_quads++;
+        return true;
+    }
+
+    // Updates the counters after drawing `written` out of `count` sprites directly, the rest were culled.
+    void CountSprites(std::size_t count, std::size_t written)
+    {
+        Graphics::RenderCounters &counters = Graphics::GlobalRenderCounters::value;
+        counters.quads += written;
+        counters.triangles += written * 2;
+        counters.culled_quads += count - written;
+    }
+
+    [[nodiscard]] bool SpriteInView(const Sprite &sprite) const
+    {
+        return (sprite.pos + sprite.size >= view_min).all() && (sprite.pos <= view_max).all();
+    }
+
+    // Writes 4 vectors per sprite to `out`, see `instanced_vertex_source` for the layout.
+    // If `cull` is true, skips the sprites outside of the view. Returns the number of written sprites.
+    std::size_t ExpandSpriteInstances(std::span<const Sprite> sprites, fvec4 *out, bool cull) const
+    {
+        fvec4 *begin = out;
+        for (const Sprite &sprite : sprites)
+        {
+            if (cull && !SpriteInView(sprite))
+                continue;
+
+            fvec2 tex_pos = sprite.tex_pos;
+            fvec2 tex_size = sprite.size;
+            if (sprite.flip_x)
+            {
+                tex_pos.x += tex_size.x;
+                tex_size.x = -tex_size.x;
+            }
+            if (sprite.flip_y)
+            {
+                tex_pos.y += tex_size.y;
+                tex_size.y = -tex_size.y;
+            }
+
+            *out++ = fvec4(sprite.pos.x, sprite.pos.y, sprite.size.x, 0);
+            *out++ = fvec4(0, sprite.size.y, tex_pos.x, tex_pos.y);
+            *out++ = fvec4(tex_size.x, tex_size.y, sprite.has_texture ? sprite.mix : -1, sprite.beta);
+            *out++ = sprite.color.to_vec4(sprite.alpha);
+        }
+        return (out - begin) / 4;
+    }
+
+    // Writes 4 vertices per sprite to `out`, in the same order as `AddQuad()` expects them.
+    // If `cull` is true, skips the sprites outside of the view. Returns the number of written sprites.
+    std::size_t ExpandSprites(std::span<const Sprite> sprites, Attribs *out, bool cull) const
+    {
+        Attribs *begin = out;
+        for (const Sprite &sprite : sprites)
+        {
+            if (cull && !SpriteInView(sprite))
+                continue;
+
+            fvec2 a = sprite.pos;
+            fvec2 b = sprite.pos + sprite.size;
+            fvec2 tex_a = sprite.tex_pos;
+            fvec2 tex_b = sprite.tex_pos + sprite.size;
+            if (sprite.flip_x)
+                std::swap(tex_a.x, tex_b.x);
+            if (sprite.flip_y)
+                std::swap(tex_a.y, tex_b.y);
+
+            // Same as in `Quad_t`, with and without a texture.
+            fvec4 color = sprite.color.to_vec4(sprite.has_texture ? 0 : sprite.alpha);
+            fvec3 factors(sprite.has_texture ? sprite.mix : 0, sprite.has_texture ? sprite.alpha : 0, sprite.beta);
+
+            Attribs corners[4];
+            corners[0].pos = a;
+            corners[1].pos = fvec2(b.x, a.y);
+            corners[2].pos = b;
+            corners[3].pos = fvec2(a.x, b.y);
+            corners[0].texcoord = tex_a;
+            corners[1].texcoord = fvec2(tex_b.x, tex_a.y);
+            corners[2].texcoord = tex_b;
+            corners[3].texcoord = fvec2(tex_a.x, tex_b.y);
+            for (Attribs &corner : corners)
+            {
+                corner.color = color;
+                corner.factors = factors;
+            }
+
+            out = std::copy_n(corners, 4, out);
+        }
+        return (out - begin) / 4;
+    }
+
+    void AddQuad(const Attribs &a, const Attribs &b, const Attribs &c, const Attribs &d)
+    {
+        if (target_mesh)
+        {
+            // Same order as in `SimpleRenderQueue::Add()`.
+            AddTriangle(a, b, d);
+            AddTriangle(d, b, c);
+            return;
+        }
+
+        Graphics::RenderCounters &counters = Graphics::GlobalRenderCounters::value;
+        counters.quads++;
+        counters.triangles += 2;
+        if (deferred)
+            AddDeferredQuad(a, b, c, d);
+        else
+            QueueQuad(a, b, c, d);
+    }
 };
 
+struct Render::Mesh::Data
+{
+    Graphics::VertexBuffer<Render::Data::Attribs> buffer;
+    int vertex_count = 0;
+};
+
+void Render::Data::DrawMeshNow(const Mesh &mesh, fvec2 offset)
+{
+    FlushQueue();
+    FlushInstances();
+    uni.matrix = applied.matrix * fmat4::translate(offset.to_vec3(0));
+    mesh.data->buffer.Draw(Graphics::triangles, mesh.data->vertex_count);
+    uni.matrix = applied.matrix;
+}
+
 void *Render::GetRenderQueuePtr()
 {
-    return &data->queue;
+    return data.get();
 }
 
 Render::Render() {}
 
-Render::Render(std::size_t queue_size, const Graphics::ShaderConfig &config)
+Render::Render(std::size_t queue_size, const Graphics::ShaderConfig &config, Backend backend)
 {
-    data = std::make_unique<Data>(queue_size, config);
+    data = std::make_unique<Data>(queue_size, config, backend);
     SetMatrix(fmat4());
     SetColorMatrix(fmat4());
 }
@@ -85,19 +583,48 @@ void Render::BindShader() const
 
 void Render::Finish()
 {
-    data->queue.Flush();
+    data->FlushDeferred();
+
+    // At most one of those is not empty.
+    data->FlushQueue();
+    data->FlushInstances();
 }
 
-void Render::SetTextureUnit(const Graphics::TexUnit &unit)
+void Render::SetDeferred(bool deferred)
 {
+    if (deferred == data->deferred)
+        return;
     Finish();
-    data->uni.texture = unit;
+    data->deferred = deferred;
+    data->deferred_state_index = -1;
+    data->ApplyState(data->state);
+}
+
+bool Render::IsDeferred() const
+{
+    return data->deferred;
+}
+
+void Render::SetLayer(int layer)
+{
+    data->layer = layer;
+}
+
+int Render::GetLayer() const
+{
+    return data->layer;
+}
+
+void Render::SetTextureUnit(const Graphics::TexUnit &unit)
+{
+    data->state.texture_index = unit.Index();
+    data->StateChanged();
 }
 
 void Render::SetTextureSize(ivec2 size)
 {
-    Finish();
-    data->uni.tex_size = size;
+    data->state.tex_size = size;
+    data->StateChanged();
 }
 
 void Render::SetTexture(const Graphics::Texture &tex)
@@ -108,14 +635,140 @@ void Render::SetTexture(const Graphics::Texture &tex)
 
 void Render::SetMatrix(const fmat4 &m)
 {
-    Finish();
-    data->uni.matrix = m;
+    data->state.matrix = m;
+    data->StateChanged();
+
+    // Map the corners of the clip space back.
+    fmat4 inv = m.inverse();
+    data->view_min = fvec2(std::numeric_limits<float>::infinity());
+    data->view_max = -data->view_min;
+    for (fvec2 corner : {fvec2(-1,-1), fvec2(1,-1), fvec2(-1,1), fvec2(1,1)})
+    {
+        fvec4 point = inv * corner.to_vec4(0, 1);
+        fvec2 pos = point.to_vec2() / point.w;
+        data->view_min = min(data->view_min, pos);
+        data->view_max = max(data->view_max, pos);
+    }
 }
 
 void Render::SetColorMatrix(const fmat4 &m)
 {
-    Finish();
-    data->uni.color_matrix = m;
+    data->state.color_matrix = m;
+    data->StateChanged();
+}
+
+const Graphics::SimpleRenderQueueStats &Render::GetQueueStats() const
+{
+    return data->queue.GetStats();
+}
+
+void Render::ResetQueueStats()
+{
+    data->queue.ResetStats();
+}
+
+std::vector<Render::Sprite> &Render::SpriteBuffer()
+{
+    data->sprite_buffer.clear();
+    return data->sprite_buffer;
+}
+
+void Render::DrawSprites(std::span<const Sprite> sprites)
+{
+    if (data->target_mesh)
+    {
+        // Never cull when recording a mesh, since it can be drawn with a different matrix.
+        for (const Sprite &sprite : sprites)
+        {
+            Data::Attribs corners[4];
+            (void)data->ExpandSprites({&sprite, 1}, corners, false);
+            data->AddQuad(corners[0], corners[1], corners[2], corners[3]);
+        }
+        return;
+    }
+
+    if (data->deferred)
+    {
+        data->AddDeferredSprites(sprites);
+        return;
+    }
+
+    if (data->backend == Backend::instanced)
+    {
+        while (!sprites.empty())
+        {
+            data->FlushQueue();
+            if (data->instance_count == Data::instance_batch_size)
+                data->FlushInstances();
+
+            std::size_t batch = std::min(sprites.size(), std::size_t(Data::instance_batch_size - data->instance_count));
+            std::size_t written = data->ExpandSpriteInstances(sprites.first(batch), data->instances.data() + 4 * data->instance_count, true);
+            data->instance_count += int(written);
+            data->CountSprites(batch, written);
+            sprites = sprites.subspan(batch);
+        }
+        return;
+    }
+
+    data->FlushInstances();
+
+    while (!sprites.empty())
+    {
+        std::size_t batch = std::min(sprites.size(), data->queue.Size());
+        std::size_t written = data->ExpandSprites(sprites.first(batch), data->queue.AddUninitialized(batch), true);
+        data->queue.RemoveLast(batch - written);
+        data->CountSprites(batch, written);
+        sprites = sprites.subspan(batch);
+    }
+}
+
+Render::Mesh::Mesh() {}
+Render::Mesh::Mesh(Mesh &&) noexcept = default;
+Render::Mesh &Render::Mesh::operator=(Mesh &&) noexcept = default;
+Render::Mesh::~Mesh() = default;
+
+bool Render::Mesh::IsEmpty() const
+{
+    return !data || data->vertex_count == 0;
+}
+
+void Render::BeginMesh(Mesh &mesh)
+{
+    ASSERT(!data->target_mesh, "2D poly renderer: Nested `BeginMesh()` calls.");
+    // No need to flush anything, recording a mesh doesn't touch the queue.
+    data->target_mesh = &mesh;
+    data->mesh_vertices.clear();
+}
+
+void Render::EndMesh()
+{
+    ASSERT(data->target_mesh, "2D poly renderer: `EndMesh()` without `BeginMesh()`.");
+    Mesh &mesh = *std::exchange(data->target_mesh, nullptr);
+
+    if (!mesh.data)
+        mesh.data = std::make_unique<Mesh::Data>();
+
+    if (!mesh.data->buffer)
+        mesh.data->buffer = Graphics::VertexBuffer<Render::Data::Attribs>(nullptr);
+    mesh.data->buffer.SetData(int(data->mesh_vertices.size()), data->mesh_vertices.data(), Graphics::static_draw);
+    mesh.data->vertex_count = int(data->mesh_vertices.size());
+
+    Graphics::RenderCounters &counters = Graphics::GlobalRenderCounters::value;
+    counters.vertices += data->mesh_vertices.size();
+    counters.bytes += data->mesh_vertices.size() * sizeof(Data::Attribs);
+}
+
+void Render::DrawMesh(const Mesh &mesh, fvec2 offset)
+{
+    ASSERT(!data->target_mesh, "2D poly renderer: Can't draw a mesh while recording one.");
+    if (mesh.IsEmpty())
+        return;
+
+    Graphics::GlobalRenderCounters::value.triangles += mesh.data->vertex_count / 3;
+    if (data->deferred)
+        data->AddDeferredMesh(mesh, offset);
+    else
+        data->DrawMeshNow(mesh, offset);
 }
 
 Render::Quad_t::~Quad_t()
@@ -134,37 +787,14 @@ Render::Quad_t::~Quad_t()
     if (data.abs_tex_pos)
         data.tex_size -= data.tex_pos;
 
-    Render::Data::Attribs out[4];
-
-    if (data.has_texture)
-    {
-        for (int i = 0; i < 4; i++)
-        {
-            out[i].color = data.colors[i].to_vec4(0);
-            out[i].factors.x = data.tex_color_factors[i];
-            out[i].factors.y = data.alpha[i];
-        }
-
-        if (data.center_pos_tex)
-        {
-            if (data.tex_size.x)
-                data.center.x *= data.size.x / data.tex_size.x;
-            if (data.tex_size.y)
-                data.center.y *= data.size.y / data.tex_size.y;
-        }
-    }
-    else
+    if (data.has_texture && data.center_pos_tex)
     {
-        for (int i = 0; i < 4; i++)
-        {
-            out[i].color = data.colors[i].to_vec4(data.alpha[i]);
-            out[i].factors.x = out[i].factors.y = 0;
-        }
+        if (data.tex_size.x)
+            data.center.x *= data.size.x / data.tex_size.x;
+        if (data.tex_size.y)
+            data.center.y *= data.size.y / data.tex_size.y;
     }
 
-    for (int i = 0; i < 4; i++)
-        out[i].factors.z = data.beta[i];
-
     if (data.flip_x)
     {
         data.tex_pos.x += data.tex_size.x;
@@ -180,6 +810,8 @@ Render::Quad_t::~Quad_t()
             data.center.y = data.size.y - data.center.y;
     }
 
+    Render::Data::Attribs out[4];
+
     out[0].pos = -data.center;
     out[2].pos = data.size - data.center;
     out[1].pos = fvec2(out[2].pos.x, out[0].pos.y);
@@ -196,12 +828,39 @@ Render::Quad_t::~Quad_t()
             it.pos += data.pos;
     }
 
+    // Skip the quad if it's not visible, before computing the rest of the attributes.
+    fvec2 bounds_min = min(min(out[0].pos, out[1].pos), min(out[2].pos, out[3].pos));
+    fvec2 bounds_max = max(max(out[0].pos, out[1].pos), max(out[2].pos, out[3].pos));
+    if (((Render::Data *)queue)->CullQuad(bounds_min, bounds_max))
+        return;
+
+    if (data.has_texture)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            out[i].color = data.colors[i].to_vec4(0);
+            out[i].factors.x = data.tex_color_factors[i];
+            out[i].factors.y = data.alpha[i];
+        }
+    }
+    else
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            out[i].color = data.colors[i].to_vec4(data.alpha[i]);
+            out[i].factors.x = out[i].factors.y = 0;
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+        out[i].factors.z = data.beta[i];
+
     out[0].texcoord = data.tex_pos;
     out[2].texcoord = data.tex_pos + data.tex_size;
     out[1].texcoord = {out[2].texcoord.x, out[0].texcoord.y};
     out[3].texcoord = {out[0].texcoord.x, out[2].texcoord.y};
 
-    ((decltype(Render::Data::queue) *)queue)->Add(out[0], out[1], out[2], out[3]);
+    ((Render::Data *)queue)->AddQuad(out[0], out[1], out[2], out[3]);
 }
 
 Render::Triangle_t::~Triangle_t()
@@ -247,45 +906,38 @@ Render::Triangle_t::~Triangle_t()
             it.pos = (data.matrix * it.pos.to_vec3(1)).to_vec2();
     }
 
-    ((decltype(Render::Data::queue) *)queue)->Add(out[0], out[1], out[2]);
+    ((Render::Data *)queue)->AddTriangle(out[0], out[1], out[2]);
 }
 
-Render::Text_t::~Text_t()
+// Converts the text to a list of textured sprites, relative to the text position.
+// The color, alpha, and beta of the sprites are left as is.
+static void LayoutText(const Graphics::Text &text, ivec2 align, int align_box_x, std::vector<Render::Sprite> &out)
 {
-    if (!renderer)
-        return;
-
-    Graphics::Text::Stats stats = data.text.ComputeStats();
-
-    ivec2 align_box(data.has_box_alignment ? data.align_box_x : data.align.x, data.align.y);
+    Graphics::Text::Stats stats = text.ComputeStats();
 
-    fvec2 pos = data.pos;
+    ivec2 align_box(align_box_x, align.y);
 
     fvec2 offset = -stats.size * (1 + align_box) / 2;
-    offset.x += stats.size.x * (1 + data.align.x) / 2; // Note that we don't change vertical position here.
+    offset.x += stats.size.x * (1 + align.x) / 2; // Note that we don't change vertical position here.
 
     float line_start_offset_x = offset.x;
 
-    for (size_t line_index = 0; line_index < data.text.lines.size(); line_index++)
+    for (size_t line_index = 0; line_index < text.lines.size(); line_index++)
     {
-        const Graphics::Text::Line &line = data.text.lines[line_index];
+        const Graphics::Text::Line &line = text.lines[line_index];
         const Graphics::Text::Stats::Line &line_stats = stats.lines[line_index];
 
-        offset.x = line_start_offset_x - line_stats.width * (1 + data.align.x) / 2;
+        offset.x = line_start_offset_x - line_stats.width * (1 + align.x) / 2;
         offset.y += line_stats.ascent;
 
         for (const Graphics::Text::Symbol &symbol : line.symbols)
         {
-            fvec2 symbol_pos;
-
-            if (!data.has_matrix)
-                symbol_pos = pos + offset + symbol.offset;
-            else
-                symbol_pos = pos + (data.matrix * (offset + symbol.offset).to_vec3(1)).to_vec2();
-
-            auto quad = renderer->fquad(symbol_pos, symbol.size).tex(symbol.texture_pos).color(data.color).mix(0).alpha(data.alpha).beta(data.beta);
-            if (data.has_matrix)
-                quad.matrix(data.matrix.to_mat2()).pixel_center(fvec2(0));
+            Render::Sprite &sprite = out.emplace_back();
+            sprite.pos = offset + symbol.offset;
+            sprite.size = symbol.size;
+            sprite.tex_pos = symbol.texture_pos;
+            sprite.has_texture = true;
+            sprite.mix = 0;
 
             offset.x += symbol.advance + symbol.kerning;
         }
@@ -293,3 +945,94 @@ Render::Text_t::~Text_t()
         offset.y += line_stats.descent + line_stats.line_gap;
     }
 }
+
+Render::Text_t::~Text_t()
+{
+    if (!renderer)
+        return;
+
+    Render::Data &render_data = *renderer->data;
+
+    int align_box_x = data.has_box_alignment ? data.align_box_x : data.align.x;
+
+    std::vector<Sprite> uncached_layout;
+    const std::vector<Sprite> *layout = &uncached_layout;
+    if (data.font)
+    {
+        auto key = std::tuple(data.font, data.align.x, data.align.y, align_box_x, std::move(data.string));
+        auto it = render_data.text_layouts.find(key);
+        bool need_layout = it == render_data.text_layouts.end();
+        if (need_layout)
+        {
+            if (render_data.text_layouts.size() >= Render::Data::max_cached_text_layouts)
+                render_data.text_layouts.clear();
+
+            it = render_data.text_layouts.try_emplace(std::move(key)).first;
+        }
+        else if (data.font->HasGlyphFunc())
+        {
+            // Mark the glyphs as used, so the glyph cache doesn't evict them. This can change the glyphs version.
+            for (uint32_t ch : it->second.glyph_func_chars)
+                (void)data.font->Get(ch);
+        }
+
+        if (need_layout || it->second.glyphs_version != data.font->GlyphsVersion())
+        {
+            it->second.glyphs_version = data.font->GlyphsVersion();
+            it->second.sprites.clear();
+            LayoutText(Graphics::Text(*data.font, std::get<4>(it->first)), data.align, align_box_x, it->second.sprites);
+
+            it->second.glyph_func_chars.clear();
+            if (data.font->HasGlyphFunc())
+            {
+                for (uint32_t ch : Unicode::Iterator(std::get<4>(it->first)))
+                {
+                    if (ch != '\n' && !data.font->HasInsertedGlyph(ch))
+                        it->second.glyph_func_chars.push_back(ch);
+                }
+                std::sort(it->second.glyph_func_chars.begin(), it->second.glyph_func_chars.end());
+                it->second.glyph_func_chars.erase(std::unique(it->second.glyph_func_chars.begin(), it->second.glyph_func_chars.end()), it->second.glyph_func_chars.end());
+            }
+        }
+        layout = &it->second.sprites;
+    }
+    else
+    {
+        LayoutText(data.text, data.align, align_box_x, uncached_layout);
+    }
+
+    // The outline is drawn first, by offsetting the text in 4 directions.
+    int first_pass = data.has_outline ? 0 : 4;
+
+    if (data.has_matrix)
+    {
+        for (int pass = first_pass; pass <= 4; pass++)
+        {
+            fvec2 pass_offset = pass < 4 ? fvec2(ivec2::dir4(pass)) : fvec2(0);
+            fvec3 color = pass < 4 ? data.outline_color : data.color;
+            for (const Sprite &sprite : *layout)
+            {
+                fvec2 symbol_pos = data.pos + (data.matrix * (sprite.pos + pass_offset).to_vec3(1)).to_vec2();
+                renderer->fquad(symbol_pos, sprite.size).tex(sprite.tex_pos).color(color).mix(0).alpha(data.alpha).beta(data.beta).matrix(data.matrix.to_mat2()).pixel_center(fvec2(0));
+            }
+        }
+        return;
+    }
+
+    std::vector<Sprite> &sprites = render_data.text_sprites;
+    sprites.clear();
+    for (int pass = first_pass; pass <= 4; pass++)
+    {
+        fvec2 pass_pos = data.pos + (pass < 4 ? fvec2(ivec2::dir4(pass)) : fvec2(0));
+        fvec3 color = pass < 4 ? data.outline_color : data.color;
+        for (Sprite sprite : *layout)
+        {
+            sprite.pos += pass_pos;
+            sprite.color = color;
+            sprite.alpha = data.alpha;
+            sprite.beta = data.beta;
+            sprites.push_back(sprite);
+        }
+    }
+    renderer->DrawSprites(sprites);
+}
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <memory>
+#include <span>
+#include <string>
 #include <utility>
+#include <vector>
 
+#include "graphics/simple_render_queue.h"
 #include "graphics/text.h"
 #include "graphics/texture_atlas.h"
 #include "program/errors.h"
@@ -23,8 +27,15 @@ class Render
     void *GetRenderQueuePtr();
 
   public:
+    // How the quads are sent to the GPU.
+    enum class Backend
+    {
+        triangles, // Two triangles per quad, 6 full vertices.
+        instanced, // A single compact record per quad, expanded by the vertex shader. Quads with per-vertex colors fall back to triangles.
+    };
+
     Render();
-    Render(std::size_t queue_size, const Graphics::ShaderConfig &config);
+    Render(std::size_t queue_size, const Graphics::ShaderConfig &config, Backend backend = Backend::triangles);
 
     Render(Render &&) noexcept;
     Render &operator=(Render &&) noexcept;
@@ -36,6 +47,16 @@ class Render
 
     void Finish();
 
+    // In the deferred mode, quads are not drawn immediately, but saved along with the current texture and matrices.
+    // `Finish()` then draws them sorted by layer (lower layers first), changing the state only when necessary.
+    // The order of quads within a single layer is preserved. Meshes are deferred too, they must remain alive and unchanged until `Finish()`.
+    void SetDeferred(bool deferred);
+    [[nodiscard]] bool IsDeferred() const;
+
+    // The layer for the following quads, only used in the deferred mode.
+    void SetLayer(int layer);
+    [[nodiscard]] int GetLayer() const;
+
     void SetTextureUnit(const Graphics::TexUnit &unit);
     void SetTextureUnit(Graphics::TexUnit &&) = delete;
 
@@ -48,13 +69,65 @@ class Render
 
     void SetColorMatrix(const fmat4 &m);
 
+    // Statistics of the vertex buffers used by the queue. They accumulate until reset.
+    [[nodiscard]] const Graphics::SimpleRenderQueueStats &GetQueueStats() const;
+    void ResetQueueStats();
+
+    // A compact description of a quad, for `DrawSprites()`.
+    // This covers the common uses of `Quad_t`, without matrices and per-vertex colors.
+    struct Sprite
+    {
+        fvec2 pos; // The top-left corner.
+        fvec2 size;
+        fvec2 tex_pos; // The top-left corner of the texture region, which has the same size as the sprite. Ignored if `has_texture` is false.
+        fvec3 color = fvec3(0);
+        float mix = 1; // 0 - fill with color, 1 - use texture. Ignored if `has_texture` is false.
+        float alpha = 1;
+        float beta = 1; // 1 - normal blending, 0 - additive blending
+        bool has_texture = false;
+        bool flip_x = false, flip_y = false; // Flip the texture.
+    };
+
+    // Draws many sprites at once. This is faster than drawing them with `fquad()` one by one.
+    void DrawSprites(std::span<const Sprite> sprites);
+    // Returns an empty vector to fill with sprites for `DrawSprites()`, reused to avoid allocating a new one every frame.
+    // It's shared by all callers, so draw the sprites before anything else can request it.
+    [[nodiscard]] std::vector<Sprite> &SpriteBuffer();
+
+    // Static geometry stored in a persistent vertex buffer.
+    // Fill it using `BeginMesh()` and `EndMesh()`, then draw it with `DrawMesh()` as many times as needed.
+    class Mesh
+    {
+        friend class Render;
+        struct Data;
+        std::unique_ptr<Data> data;
+
+      public:
+        Mesh();
+        Mesh(Mesh &&) noexcept;
+        Mesh &operator=(Mesh &&) noexcept;
+        ~Mesh();
+
+        // Returns true if the mesh has no vertices, or wasn't filled yet.
+        [[nodiscard]] bool IsEmpty() const;
+    };
+
+    // Everything drawn between those two calls is saved to `mesh` instead of being drawn, even in the deferred mode. The previous mesh contents are discarded.
+    // The vertex buffer of the mesh is reused if it already exists.
+    void BeginMesh(Mesh &mesh);
+    void EndMesh();
+
+    // Draws a mesh in a single draw call, with all positions offset by `offset`.
+    // Uses the current texture and matrices. In the deferred mode, only a reference to the mesh is saved.
+    void DrawMesh(const Mesh &mesh, fvec2 offset = fvec2(0));
+
     class Quad_t
     {
         friend class Render;
 
         using ref = Quad_t &&;
 
-        void *queue = 0; // Actually the type should be `Graphics::SimpleRenderQueue<Attribs, 3> *`, but we don't include "graphics/simple_render_queue.h" for better compilation times.
+        void *queue = 0; // Actually the type should be `Render::Data *`, but it's incomplete here.
 
         struct Data
         {
@@ -273,7 +346,7 @@ class Render
 
         using ref = Triangle_t &&;
 
-        void *queue = 0; // Actually the type should be `Graphics::SimpleRenderQueue<Attribs, 3> *`, but we don't include "graphics/simple_render_queue.h" for better compilation times.
+        void *queue = 0; // Actually the type should be `Render::Data *`, but it's incomplete here.
 
         struct Data
         {
@@ -427,6 +500,10 @@ class Render
             fvec2 pos;
             Graphics::Text text;
 
+            // If not null, `text` is unused, and the layout of `string` is taken from the cache.
+            const Graphics::Font *font = nullptr;
+            std::string string;
+
             ivec2 align = ivec2(0);
 
             bool has_box_alignment = 0;
@@ -438,6 +515,9 @@ class Render
 
             bool has_matrix = 0;
             fmat3 matrix = {};
+
+            bool has_outline = 0;
+            fvec3 outline_color = fvec3(0);
         };
         Data data;
 
@@ -446,6 +526,12 @@ class Render
             data.pos = pos;
             data.text = std::move(text);
         }
+        Text_t(Render *renderer, fvec2 pos, const Graphics::Font &font, std::string string) : renderer(renderer)
+        {
+            data.pos = pos;
+            data.font = &font;
+            data.string = std::move(string);
+        }
       public:
         Text_t(Text_t &&other) noexcept : renderer(std::exchange(other.renderer, {})), data(std::move(other.data)) {}
         Text_t &operator=(Text_t other)
@@ -536,6 +622,12 @@ class Render
             scale(fvec2(s));
             return (ref)*this;
         }
+        ref outline(fvec3 c) // Draws a 1-pixel outline of this color under the text, in the same batch.
+        {
+            data.has_outline = 1;
+            data.outline_color = c;
+            return (ref)*this;
+        }
 
         ~Text_t();
     };
@@ -582,4 +674,15 @@ class Render
     {
         return Text_t(this, pos, std::move(text));
     }
+
+    // Those cache the text layout for each font, string, and alignment, so they are cheaper if the same string is drawn many times.
+    Text_t ftext(fvec2 pos, const Graphics::Font &font, std::string string)
+    {
+        return Text_t(this, pos, font, std::move(string));
+    }
+    Text_t itext(fvec2 pos, const Graphics::Font &font, std::string string) = delete;
+    Text_t itext(ivec2 pos, const Graphics::Font &font, std::string string)
+    {
+        return Text_t(this, pos, font, std::move(string));
+    }
 };
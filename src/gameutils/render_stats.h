@@ -0,0 +1,30 @@
+#pragma once
+
+#include "graphics/render_counters.h"
+
+namespace GameUtils
+{
+    // Computes per-frame render statistics from `Graphics::GlobalRenderCounters`.
+    class RenderStats
+    {
+        Graphics::RenderCounters last_total;
+        Graphics::RenderCounters last_frame;
+
+      public:
+        RenderStats() {}
+
+        // Call this once per frame, after rendering.
+        void Update()
+        {
+            const Graphics::RenderCounters &total = Graphics::GlobalRenderCounters::value;
+            last_frame = total - last_total;
+            last_total = total;
+        }
+
+        // The values for the last frame.
+        [[nodiscard]] const Graphics::RenderCounters &Frame() const
+        {
+            return last_frame;
+        }
+    };
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "graphics/texture_atlas.h"
+#include "meta/string_template_params.h"
+#include "program/errors.h"
+
+namespace Graphics
+{
+    namespace impl
+    {
+        struct MentionedAtlasRegions
+        {
+            std::vector<std::string_view> names;
+            std::vector<TextureAtlas::Region> regions; // Same order as `names`. Filled by `ResolveMentionedAtlasRegions()`.
+            bool resolved = false;
+        };
+
+        inline MentionedAtlasRegions &GetMentionedAtlasRegions()
+        {
+            static MentionedAtlasRegions ret;
+            return ret;
+        }
+
+        template <Meta::ConstString Name>
+        struct RegisterAtlasRegion
+        {
+            // The index in `MentionedAtlasRegions::regions`.
+            [[maybe_unused]] inline static const std::size_t index = []
+            {
+                MentionedAtlasRegions &data = GetMentionedAtlasRegions();
+                data.names.push_back(std::string_view(Name.str, Name.size));
+                data.regions.emplace_back();
+                return data.names.size() - 1;
+            }();
+        };
+    }
+
+    // Returns a texture atlas region by name. This is a single array access, there's no lookup.
+    // The region is looked up by `ResolveMentionedAtlasRegions()`, which magically knows all names mentioned in `AtlasRegion()` calls.
+    template <Meta::ConstString Name>
+    [[nodiscard]] const TextureAtlas::Region &AtlasRegion()
+    {
+        const impl::MentionedAtlasRegions &data = impl::GetMentionedAtlasRegions();
+        ASSERT(data.resolved, "Attempt to use `Graphics::AtlasRegion()` before `Graphics::ResolveMentionedAtlasRegions()`.");
+        return data.regions[impl::RegisterAtlasRegion<Name>::index];
+    }
+
+    // Looks up all regions mentioned in `AtlasRegion()` calls in `atlas`. Call this again if the atlas is reloaded.
+    // Throws if any of them are missing, listing all missing names at once.
+    inline void ResolveMentionedAtlasRegions(const TextureAtlas &atlas)
+    {
+        impl::MentionedAtlasRegions &data = impl::GetMentionedAtlasRegions();
+
+        std::string missing;
+        for (std::size_t i = 0; i < data.names.size(); i++)
+        {
+            if (!atlas.GetOpt(std::string(data.names[i]), data.regions[i]))
+                missing += FMT("\n    {}", data.names[i]);
+        }
+
+        if (!missing.empty())
+            Program::Error("Those images are missing in texture atlas for `", atlas.SourceDirectory(), "`:", missing);
+
+        data.resolved = true;
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <utility>
+
+#include <cglfl/cglfl.hpp>
+
+#include "graphics/render_counters.h"
+#include "graphics/texture.h"
+#include "macros/finally.h"
+#include "program/errors.h"
+
+namespace Graphics
+{
+    // A buffer texture. Lets shaders read large arrays from a buffer object with `texelFetch()`, without the limits of uniform arrays.
+    // Owns a buffer object, a texture that views it, and a texture unit the texture is bound to.
+    // Use `Uniform<BufferTexture>` to access it from shaders, it becomes a `samplerBuffer`.
+    // Needs GL 3.1. If it's not available, `BufferTexture(format)` throws, so check `is_supported` first.
+    class BufferTexture
+    {
+        struct Data
+        {
+            GLuint buffer = 0;
+            GLuint texture = 0;
+        };
+
+        Data data;
+        TexUnit unit;
+
+      public:
+        static constexpr bool is_supported =
+        #ifdef glTexBuffer
+            true;
+        #else
+            false;
+        #endif
+
+        BufferTexture() {}
+
+        // `format` is the sized internal format of the elements, e.g. `GL_RGBA32F` for `fvec4`.
+        BufferTexture(GLenum format)
+        {
+            #ifdef glTexBuffer
+            glGenBuffers(1, &data.buffer);
+            if (!data.buffer)
+                Program::Error("Unable to create a buffer for a buffer texture.");
+            FINALLY_ON_THROW( glDeleteBuffers(1, &data.buffer); )
+
+            glGenTextures(1, &data.texture);
+            if (!data.texture)
+                Program::Error("Unable to create a buffer texture.");
+            FINALLY_ON_THROW( glDeleteTextures(1, &data.texture); )
+
+            unit = TexUnit(nullptr);
+            unit.Activate();
+            glBindTexture(GL_TEXTURE_BUFFER, data.texture);
+            GlobalRenderCounters::value.texture_binds++;
+
+            glBindBuffer(GL_TEXTURE_BUFFER, data.buffer);
+            glTexBuffer(GL_TEXTURE_BUFFER, format, data.buffer);
+            #else
+            (void)format;
+            Program::Error("Buffer textures are not supported.");
+            #endif
+        }
+
+        BufferTexture(BufferTexture &&other) noexcept : data(std::exchange(other.data, {})), unit(std::move(other.unit)) {}
+        BufferTexture &operator=(BufferTexture other) noexcept
+        {
+            std::swap(data, other.data);
+            std::swap(unit, other.unit);
+            return *this;
+        }
+
+        ~BufferTexture()
+        {
+            // Deleting 0 is a no-op, but GL could be unloaded at this point.
+            if (data.texture)
+                glDeleteTextures(1, &data.texture);
+            if (data.buffer)
+                glDeleteBuffers(1, &data.buffer);
+        }
+
+        explicit operator bool() const
+        {
+            return bool(data.texture);
+        }
+
+        // The texture unit index, used by `Uniform<BufferTexture>`.
+        int Index() const
+        {
+            return unit.Index();
+        }
+
+        // Replaces the contents. The old storage is orphaned, so this doesn't wait for the draw calls that still use it.
+        void SetData(int bytes, const void *source)
+        {
+            ASSERT(*this, "Attempt to use a null buffer texture.");
+            if (!*this)
+                return;
+            #ifdef glTexBuffer
+            glBindBuffer(GL_TEXTURE_BUFFER, data.buffer);
+            glBufferData(GL_TEXTURE_BUFFER, bytes, source, GL_STREAM_DRAW);
+            #else
+            (void)bytes;
+            (void)source;
+            #endif
+        }
+    };
+}
@@ -1,14 +1,19 @@
 #pragma once
 
+#include "graphics/atlas_regions.h"
 #include "graphics/blending.h"
+#include "graphics/buffer_texture.h"
 #include "graphics/clear.h"
 #include "graphics/dummy_vertex_array.h"
 #include "graphics/errors.h"
+#include "graphics/fence.h"
 #include "graphics/font_file.h"
 #include "graphics/font.h"
 #include "graphics/framebuffer.h"
+#include "graphics/glyph_cache.h"
 #include "graphics/image.h"
 #include "graphics/index_buffer.h"
+#include "graphics/render_counters.h"
 #include "graphics/scissor.h"
 #include "graphics/shader.h"
 #include "graphics/simple_render_queue.h"
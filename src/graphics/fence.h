@@ -0,0 +1,79 @@
+#pragma once
+
+#include <utility>
+
+#include <cglfl/cglfl.hpp>
+
+#include "program/errors.h"
+
+namespace Graphics
+{
+    // A GL sync object. Lets you check if the GPU has finished executing all commands issued before the fence.
+    // Needs GL 3.2 or `GL_ARB_sync`. `is_supported` only tells if the fences are compiled in, use `VertexBuffers::SyncSupported()` to check the context.
+    // If they're not compiled in, `Fence(nullptr)` creates a null fence.
+    class Fence
+    {
+        #ifdef glFenceSync
+        GLsync handle = 0;
+        #endif
+
+      public:
+        static constexpr bool is_supported =
+        #ifdef glFenceSync
+            true;
+        #else
+            false;
+        #endif
+
+        Fence() {}
+
+        // Inserts a fence into the command stream.
+        Fence(decltype(nullptr))
+        {
+            #ifdef glFenceSync
+            handle = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            if (!handle)
+                Program::Error("Unable to create a fence.");
+            #endif
+        }
+
+        #ifdef glFenceSync
+        Fence(Fence &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+        Fence &operator=(Fence other) noexcept
+        {
+            std::swap(handle, other.handle);
+            return *this;
+        }
+
+        ~Fence()
+        {
+            if (handle)
+                glDeleteSync(handle); // Deleting 0 is a no-op, but GL could be unloaded at this point.
+        }
+        #endif
+
+        explicit operator bool() const
+        {
+            #ifdef glFenceSync
+            return bool(handle);
+            #else
+            return false;
+            #endif
+        }
+
+        // Returns true if the GPU has finished all commands before the fence. Never waits.
+        // Null fences are always signaled.
+        [[nodiscard]] bool IsSignaled() const
+        {
+            #ifdef glFenceSync
+            if (!handle)
+                return true;
+            GLint status = GL_SIGNALED;
+            glGetSynciv(handle, GL_SYNC_STATUS, 1, nullptr, &status);
+            return status == GL_SIGNALED;
+            #else
+            return true;
+            #endif
+        }
+    };
+}
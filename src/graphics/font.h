@@ -27,6 +27,13 @@ namespace Graphics
         using kerning_func_t = std::function<int(uint32_t, uint32_t)>;
         kerning_func_t kerning_func = 0;
 
+        // Called by `Get()` for glyphs that aren't in `glyphs`. Returns null if the glyph isn't available. See `GlyphCache`.
+        using glyph_func_t = std::function<const Glyph *(uint32_t)>;
+        glyph_func_t glyph_func = 0;
+
+        // Incremented when glyphs returned by `glyph_func` change their texture positions, so all cached layouts using this font become invalid.
+        int glyphs_version = 0;
+
         // Some code might rely on references not being invalidated on insertion. Keep that in mind if you decide to change the container.
         std::unordered_map<uint32_t, Glyph> glyphs;
         Glyph default_glyph;
@@ -48,6 +55,14 @@ namespace Graphics
         {
             kerning_func = std::move(new_kerning_func);
         }
+        void SetGlyphFunc(glyph_func_t new_glyph_func) // Use null function to disable.
+        {
+            glyph_func = std::move(new_glyph_func);
+        }
+        void GlyphsChanged()
+        {
+            glyphs_version++;
+        }
 
         int Ascent() const
         {
@@ -86,6 +101,20 @@ namespace Graphics
                 return 0;
         }
 
+        bool HasGlyphFunc() const
+        {
+            return bool(glyph_func);
+        }
+        // Returns true if the glyph was added with `Insert()`, rather than coming from the glyph func.
+        bool HasInsertedGlyph(uint32_t ch) const
+        {
+            return glyphs.contains(ch);
+        }
+        int GlyphsVersion() const
+        {
+            return glyphs_version;
+        }
+
         Glyph &DefaultGlyph()
         {
             return default_glyph;
@@ -96,12 +125,17 @@ namespace Graphics
         }
 
         // Note that returned references remain valid even after insertions.
+        // The glyphs coming from the glyph func can be replaced by later `Get()` calls. When that happens, `GlyphsVersion()` changes.
         const Glyph &Get(uint32_t ch) const
         {
             if (auto it = glyphs.find(ch); it != glyphs.end())
                 return it->second;
-            else
-                return default_glyph;
+            if (glyph_func)
+            {
+                if (const Glyph *glyph = glyph_func(ch))
+                    return *glyph;
+            }
+            return default_glyph;
         }
         Glyph &Insert(uint32_t ch) // If the glyph already exists, returns a reference to it instead of creating a new one.
         {
@@ -375,7 +375,9 @@ namespace Graphics
         }
 
         // Pack rectangles.
-        if (Packing::PackRects(size, rects.data(), rects.size(), add_gaps))
+        Packing::Options pack_options;
+        pack_options.inner_gaps = add_gaps;
+        if (Packing::Pack(size, rects.data(), rects.size(), pack_options).rects_not_packed)
             Program::Error("Unable to fit the font atlas for into ", size.x, 'x', size.y, " rectangle.");
 
         // Fill target area with transparent black.
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "graphics/font.h"
+#include "graphics/font_file.h"
+#include "graphics/image.h"
+#include "graphics/texture.h"
+#include "program/errors.h"
+#include "utils/mat.h"
+#include "utils/unicode.h"
+
+namespace Graphics
+{
+    // Rasterizes glyphs of a `FontFile` on first use into a rectangle of a texture, evicting the least recently used glyphs when it runs out of space.
+    // Attaches itself to a `Font`, so `Font::Get()` falls back to it for the glyphs not added by `MakeFontAtlas()`.
+    // The rectangle is split into a grid of equal cells. Glyphs larger than a cell are not cached, and the default glyph is used for them instead.
+    // The glyphs used since the last `NextFrame()` are never evicted, since the quads using them might still be waiting to be drawn.
+    class GlyphCache
+    {
+        struct Slot
+        {
+            uint32_t ch = 0;
+            std::uint64_t last_used_frame = 0;
+            Font::Glyph glyph;
+        };
+
+        struct Data
+        {
+            Font *target = nullptr;
+            const FontFile *source = nullptr;
+            FontFile::RenderFlags render_flags = FontFile::none;
+            Texture *texture = nullptr;
+
+            ivec2 pos = ivec2(0);
+            ivec2 cell_size = ivec2(0);
+            ivec2 cell_step = ivec2(0); // Cell size plus the gap.
+            int cell_count_x = 0;
+
+            std::vector<Slot> slots; // Has a fixed size, one slot per cell.
+            int used_slots = 0; // Slots are filled in order, so the ones starting from this index are free.
+            std::unordered_map<uint32_t, int> slot_indices; // Maps characters to indices in `slots`.
+            std::unordered_set<uint32_t> rejected; // Characters missing in the font, and the ones too large for a cell.
+
+            std::uint64_t frame = 1;
+
+            Image cell_image; // A temporary buffer for texture uploads.
+
+            const Font::Glyph *Find(uint32_t ch)
+            {
+                if (auto it = slot_indices.find(ch); it != slot_indices.end())
+                {
+                    Slot &slot = slots[it->second];
+                    slot.last_used_frame = frame;
+                    return &slot.glyph;
+                }
+
+                // The default glyph is handled by the font itself.
+                if (ch == Unicode::default_char || rejected.contains(ch))
+                    return nullptr;
+
+                if (!source->HasGlyph(ch))
+                {
+                    rejected.insert(ch);
+                    return nullptr;
+                }
+
+                // Find a free slot, or the least recently used one.
+                int slot_index = -1;
+                if (used_slots < int(slots.size()))
+                {
+                    slot_index = used_slots;
+                }
+                else
+                {
+                    for (int i = 0; i < int(slots.size()); i++)
+                    {
+                        if (slots[i].last_used_frame != frame && (slot_index == -1 || slots[i].last_used_frame < slots[slot_index].last_used_frame))
+                            slot_index = i;
+                    }
+
+                    if (slot_index == -1)
+                    {
+                        // Every cached glyph is used in this frame. Make sure the layouts using the default glyph instead of this one are eventually rebuilt.
+                        target->GlyphsChanged();
+                        return nullptr;
+                    }
+                }
+
+                FontFile::GlyphData glyph_data = source->GetGlyph(ch, render_flags);
+                if ((glyph_data.image.Size() > cell_size).any())
+                {
+                    rejected.insert(ch);
+                    return nullptr;
+                }
+
+                Slot &slot = slots[slot_index];
+                if (slot_index < used_slots)
+                {
+                    // Evict the old glyph. The layouts using it are no longer valid.
+                    slot_indices.erase(slot.ch);
+                    target->GlyphsChanged();
+                }
+                else
+                {
+                    used_slots++;
+                }
+
+                ivec2 cell_pos = pos + ivec2(slot_index % cell_count_x, slot_index / cell_count_x) * cell_step;
+
+                // Upload the whole cell, to erase the previous glyph.
+                cell_image.UnsafeFill(ivec2(0), cell_size, u8vec4(0));
+                if (glyph_data.image)
+                    cell_image.UnsafeDrawImage(glyph_data.image, ivec2(0));
+                texture->SetDataPart(cell_pos, cell_size, cell_image.Data());
+
+                slot.ch = ch;
+                slot.last_used_frame = frame;
+                slot.glyph.texture_pos = cell_pos;
+                slot.glyph.size = glyph_data.image.Size();
+                slot.glyph.offset = glyph_data.offset;
+                slot.glyph.advance = glyph_data.advance;
+                slot_indices.try_emplace(ch, slot_index);
+                return &slot.glyph;
+            }
+        };
+
+        std::unique_ptr<Data> data;
+
+      public:
+        GlyphCache() {}
+
+        // `target`, `source` and `texture` must remain alive as long as the cache exists.
+        // The cache uses the rectangle at `pos` with `size` in the `texture`. You should reserve it in the texture atlas.
+        // The metrics of `target` are expected to be already set, normally by `MakeFontAtlas()`.
+        // If `cell_size` is zero, it defaults to a square with the side equal to the font height.
+        GlyphCache(Font &target, const FontFile &source, FontFile::RenderFlags render_flags, Texture &texture, ivec2 pos, ivec2 size, ivec2 cell_size = ivec2(0), bool add_gaps = 1)
+            : data(std::make_unique<Data>())
+        {
+            if (cell_size == 0)
+                cell_size = ivec2(source.Height());
+
+            data->target = &target;
+            data->source = &source;
+            data->render_flags = render_flags;
+            data->texture = &texture;
+            data->pos = pos;
+            data->cell_size = cell_size;
+            data->cell_step = cell_size + add_gaps;
+
+            // The last cell doesn't need a gap after it.
+            ivec2 cell_count = (size + add_gaps) / data->cell_step;
+            if (!(cell_size > 0).all() || !(cell_count > 0).all())
+                Program::Error("Unable to fit a ", cell_size.x, 'x', cell_size.y, " glyph cache cell into a ", size.x, 'x', size.y, " rectangle.");
+            data->cell_count_x = cell_count.x;
+
+            data->slots.resize(cell_count.prod());
+            data->cell_image = Image(cell_size);
+
+            target.SetGlyphFunc([cache = data.get()](uint32_t ch){return cache->Find(ch);});
+            target.GlyphsChanged();
+        }
+
+        GlyphCache(GlyphCache &&other) noexcept : data(std::move(other.data)) {}
+        GlyphCache &operator=(GlyphCache other) noexcept
+        {
+            std::swap(data, other.data);
+            return *this;
+        }
+
+        ~GlyphCache()
+        {
+            if (data)
+            {
+                data->target->SetGlyphFunc(nullptr);
+                data->target->GlyphsChanged();
+            }
+        }
+
+        explicit operator bool() const
+        {
+            return bool(data);
+        }
+
+        // Call this once per frame, after the frame is drawn. The glyphs used before this call become eligible for eviction.
+        void NextFrame()
+        {
+            if (data)
+                data->frame++;
+        }
+
+        // Forgets all cached glyphs. Call this if the texture contents were replaced.
+        void Clear()
+        {
+            if (!data)
+                return;
+            data->used_slots = 0;
+            data->slot_indices.clear();
+            data->target->GlyphsChanged();
+        }
+
+        [[nodiscard]] int GlyphCount() const
+        {
+            return data ? data->used_slots : 0;
+        }
+        [[nodiscard]] int Capacity() const
+        {
+            return data ? int(data->slots.size()) : 0;
+        }
+    };
+}
@@ -39,7 +39,7 @@ namespace Graphics
         }
         Image(Stream::ReadOnlyData file, FlipMode flip_mode = no_flip) // Throws on failure.
         {
-            stbi_set_flip_vertically_on_load(flip_mode == flip_y);
+            stbi_set_flip_vertically_on_load_thread(flip_mode == flip_y); // The thread-local version, since images can be loaded in parallel.
             ivec2 img_size;
             uint8_t *bytes = stbi_load_from_memory(file.data(), file.size(), &img_size.x, &img_size.y, 0, 4);
             if (!bytes)
@@ -50,7 +50,9 @@ namespace Graphics
 
         explicit operator bool() const {return data.size() > 0;}
 
+        u8vec4 *Pixels() {return data.data();}
         const u8vec4 *Pixels() const {return data.data();}
+        uint8_t *Data() {return (uint8_t *)Pixels();}
         const uint8_t *Data() const {return (const uint8_t *)Pixels();}
         ivec2 Size() const {return size;}
 
@@ -83,6 +85,12 @@ namespace Graphics
                 Program::Error("Unable to write image to file: ", file_name);
         }
 
+        void FlipY() // Mirrors the image vertically, e.g. after reading it back from OpenGL.
+        {
+            for (int y = 0; y < size.y / 2; y++)
+                std::swap_ranges(&UnsafeAt(ivec2(0, y)), &UnsafeAt(ivec2(0, y)) + size.x, &UnsafeAt(ivec2(0, size.y - 1 - y)));
+        }
+
         u8vec4 &UnsafeAt(ivec2 pos)
         {
             return const_cast<u8vec4 &>(std::as_const(*this).UnsafeAt(pos));
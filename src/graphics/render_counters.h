@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Graphics
+{
+    // Counts the work sent to the GPU. The values only grow, see `GameUtils::RenderStats` for per-frame values.
+    struct RenderCounters
+    {
+        std::uint64_t quads = 0;
+        std::uint64_t culled_quads = 0; // Quads skipped because they were outside of the view.
+        std::uint64_t triangles = 0; // Including the ones quads are made of.
+        std::uint64_t vertices = 0; // Uploaded vertices.
+        std::uint64_t bytes = 0; // Uploaded bytes, both vertices and instance data.
+        std::uint64_t flushes = 0; // Draw calls issued by the render queues.
+        std::uint64_t texture_binds = 0;
+        std::uint64_t shader_binds = 0;
+
+        [[nodiscard]] RenderCounters operator-(const RenderCounters &other) const
+        {
+            RenderCounters ret;
+            ret.quads = quads - other.quads;
+            ret.culled_quads = culled_quads - other.culled_quads;
+            ret.triangles = triangles - other.triangles;
+            ret.vertices = vertices - other.vertices;
+            ret.bytes = bytes - other.bytes;
+            ret.flushes = flushes - other.flushes;
+            ret.texture_binds = texture_binds - other.texture_binds;
+            ret.shader_binds = shader_binds - other.shader_binds;
+            return ret;
+        }
+    };
+
+    class GlobalRenderCounters
+    {
+        GlobalRenderCounters() = delete;
+        ~GlobalRenderCounters() = delete;
+
+      public:
+        // Incremented by the rest of the graphics code.
+        inline static RenderCounters value;
+    };
+}
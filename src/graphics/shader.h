@@ -6,6 +6,7 @@
 
 #include <cglfl/cglfl.hpp>
 
+#include "graphics/render_counters.h"
 #include "graphics/texture.h"
 #include "graphics/types.h"
 #include "macros/finally.h"
@@ -127,6 +128,7 @@ namespace Graphics
                 return;
             binding = handle;
             glUseProgram(handle);
+            GlobalRenderCounters::value.shader_binds++;
         }
 
         template <typename T> static std::string AppendAttributesToSource(const std::string &source, const ShaderConfig &cfg, const ShaderPreferences &pref)
@@ -173,7 +175,7 @@ namespace Graphics
                 Meta::cexpr_for<Refl::Class::member_count<T>>([&](auto index)
                 {
                     constexpr int i = index.value;
-                    using field_type = typename Refl::Class::member_type<T, i>::type;
+                    using field_type = typename Refl::Class::member_type<T, i>::type_with_extent;
                     constexpr bool uni_vert = Refl::Class::member_has_attrib<T, i, Vert>;
                     constexpr bool uni_frag = Refl::Class::member_has_attrib<T, i, Frag>;
                     static_assert(!(uni_vert && uni_frag), "Can't have both `Vert` and `Frag` attributes on a single member. To use it in both shaders, remove both attributes.");
@@ -413,7 +415,7 @@ namespace Graphics
 
         inline static constexpr bool
             is_array   = std::is_array_v<type_with_extent>,
-            is_texture = std::is_same_v<type, TexUnit>,
+            is_texture = std::is_same_v<type, TexUnit> || std::is_same_v<type, BufferTexture>,
             is_bool    = std::is_same_v<Math::vec_base_t<type>, bool>;
 
         inline static constexpr int array_elements = std::extent_v<std::conditional_t<is_array, type_with_extent, type_with_extent[1]>>;
@@ -2,23 +2,55 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <type_traits>
 #include <vector>
 
+#include "graphics/fence.h"
+#include "graphics/index_buffer.h"
+#include "graphics/render_counters.h"
 #include "graphics/vertex_buffer.h"
+#include "program/errors.h"
 
 namespace Graphics
 {
+    struct SimpleRenderQueueStats
+    {
+        std::size_t flushes = 0;
+        // How many times the buffer used by the previous flush was still being read by the GPU.
+        // With a single buffer, the driver would have to wait for it. This is always 0 if sync objects are not supported.
+        std::size_t syncs_avoided = 0;
+        // How many times the next buffer in the ring was still in use (or if sync objects are not supported, always), and we had to orphan it.
+        std::size_t orphaned = 0;
+    };
+
+    // If `N == 4`, the primitives are quads. They are stored as 4 vertices each, and are drawn as triangles using a pre-built index buffer.
+    // If sync objects are supported (see `VertexBuffers::SyncSupported()`), flushes cycle through several vertex buffers, so that we don't overwrite a buffer while the GPU still reads from it.
+    //   We also check if the next buffer is still in use with a fence, and orphan it in that case.
+    // Otherwise a single buffer is used, and it's orphaned on every flush.
     template <typename T, int N>
     class SimpleRenderQueue
     {
         static_assert(Graphics::VertexBuffer<T>::is_reflected, "The type must be reflected.");
-        static_assert(N >= 1 && N <= 3, "N must be 1 (points), 2 (lines), or 3 (triangles).");
+        static_assert(N >= 1 && N <= 4, "N must be 1 (points), 2 (lines), 3 (triangles), or 4 (quads).");
+
+        static constexpr int buffer_count = 3;
+
+        struct StreamBuffer
+        {
+            Graphics::VertexBuffer<T> buffer;
+            Graphics::Fence fence; // Inserted after the last draw call that used this buffer.
+        };
 
         std::size_t pos = 0, size = 0; // These are measured in primitives, not vertices.
         std::unique_ptr<T[]> storage;
-        Graphics::VertexBuffer<T> buffer;
+        std::array<StreamBuffer, buffer_count> buffers;
+        int active_buffer_count = 1; // `buffer_count` if sync objects are supported, otherwise 1.
+        bool use_fences = false;
+        int buffer_index = 0; // The buffer used by the last flush.
+        SimpleRenderQueueStats stats;
+        Graphics::IndexBuffer<std::uint32_t> quad_indices; // Only used if `N == 4`. Two triangles per quad, same as in `Add(a,b,c,d)` for `N == 3`.
 
         template <typename ...P>
         void AddLow(const P &... p)
@@ -36,7 +68,30 @@ namespace Graphics
         SimpleRenderQueue() {}
 
         // The size is measured in primitives, not vertices.
-        SimpleRenderQueue(std::size_t size) : size(size), storage(std::make_unique<T[]>(size * N)), buffer(size * N, 0, Graphics::stream_draw) {}
+        SimpleRenderQueue(std::size_t size) : size(size), storage(std::make_unique<T[]>(size * N))
+        {
+            use_fences = Graphics::Fence::is_supported && VertexBuffers::SyncSupported();
+            active_buffer_count = use_fences ? buffer_count : 1;
+            for (int i = 0; i < active_buffer_count; i++)
+                buffers[i].buffer = Graphics::VertexBuffer<T>(size * N, 0, Graphics::stream_draw);
+
+            if constexpr (N == 4)
+            {
+                auto indices = std::make_unique<std::uint32_t[]>(size * 6);
+                for (std::size_t i = 0; i < size; i++)
+                {
+                    std::uint32_t first = i * 4;
+                    std::uint32_t *out = indices.get() + i * 6;
+                    out[0] = first;
+                    out[1] = first + 1;
+                    out[2] = first + 3;
+                    out[3] = first + 3;
+                    out[4] = first + 1;
+                    out[5] = first + 2;
+                }
+                quad_indices = Graphics::IndexBuffer<std::uint32_t>(size * 6, indices.get());
+            }
+        }
 
         [[nodiscard]] explicit operator bool()
         {
@@ -65,11 +120,68 @@ namespace Graphics
         {
             if (pos <= 0)
                 return;
-            buffer.SetDataPart(0, pos * N, storage.get());
-            buffer.Draw(std::array{points, lines, triangles}[N-1], pos * N);
+
+            stats.flushes++;
+
+            RenderCounters &counters = GlobalRenderCounters::value;
+            counters.flushes++;
+            counters.vertices += pos * N;
+            counters.bytes += pos * N * sizeof(T);
+            // Primitives are counted by the users, since they know what they put in the queue.
+
+            // A single-buffered queue would overwrite this buffer now.
+            if (!buffers[buffer_index].fence.IsSignaled())
+                stats.syncs_avoided++;
+
+            buffer_index = (buffer_index + 1) % active_buffer_count;
+            StreamBuffer &target = buffers[buffer_index];
+
+            // Without fences we can't tell if the buffer is still in use, so we always orphan it.
+            if (!use_fences || !target.fence.IsSignaled())
+            {
+                target.buffer.Orphan(Graphics::stream_draw);
+                stats.orphaned++;
+            }
+
+            target.buffer.SetDataPart(0, pos * N, storage.get());
+            if constexpr (N == 4)
+                quad_indices.Draw(target.buffer, triangles, pos * 6);
+            else
+                target.buffer.Draw(std::array{points, lines, triangles}[N-1], pos * N);
+            if (use_fences)
+                target.fence = Graphics::Fence(nullptr);
+
             pos = 0;
         }
 
+        [[nodiscard]] const SimpleRenderQueueStats &GetStats() const
+        {
+            return stats;
+        }
+        void ResetStats()
+        {
+            stats = {};
+        }
+
+        // Reserves space for `count` primitives, flushing if there's not enough space, and returns a pointer to their vertices (`N` per primitive).
+        // The caller must fill all of them. `count` must not exceed `Size()`.
+        [[nodiscard]] T *AddUninitialized(std::size_t count)
+        {
+            ASSERT(count <= size, "Too many primitives for a render queue.");
+            if (pos + count > size)
+                Flush();
+            T *ret = storage.get() + N * pos;
+            pos += count;
+            return ret;
+        }
+
+        // Removes the last `count` primitives that weren't flushed yet. Useful if `AddUninitialized()` reserved more than needed.
+        void RemoveLast(std::size_t count)
+        {
+            ASSERT(count <= pos, "Attempt to remove too many primitives from a render queue.");
+            pos -= count;
+        }
+
         void Add(const T &a) requires (N == 1)
         {
             AddLow(a);
@@ -87,5 +199,9 @@ namespace Graphics
             AddLow(a, b, d);
             AddLow(d, b, c);
         }
+        void Add(const T &a, const T &b, const T &c, const T &d) requires (N == 4)
+        {
+            AddLow(a, b, c, d);
+        }
     };
 }
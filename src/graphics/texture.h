@@ -6,6 +6,7 @@
 #include <cglfl/cglfl.hpp>
 
 #include "graphics/image.h"
+#include "graphics/render_counters.h"
 #include "macros/finally.h"
 #include "utils/mat.h"
 #include "utils/sparse_set.h"
@@ -169,6 +170,7 @@ namespace Graphics
             Activate();
             data.handle = handle;
             glBindTexture(GL_TEXTURE_2D, handle);
+            GlobalRenderCounters::value.texture_binds++;
             return std::move(*this);
         }
         TexUnit &&Attach(const TexObject &texture)
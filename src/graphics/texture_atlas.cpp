@@ -1,14 +1,164 @@
 #include "texture_atlas.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "reflection/full.h"
 #include "stream/readonly_data.h"
+#include "stream/output.h"
 #include "stream/save_to_file.h"
+#include "utils/hash.h"
+#include "utils/memory_access.h"
 #include "utils/packing.h"
+#include "utils/parallel.h"
 
 namespace Graphics
 {
+    std::string TextureAtlas::PageFileName(const std::string &image_file, int page)
+    {
+        if (page == 0)
+            return image_file;
+
+        // Insert the page index before the extension, if any.
+        std::size_t dot = image_file.find_last_of('.');
+        if (dot == std::string::npos || image_file.find_first_of("/\\", dot) != std::string::npos)
+            dot = image_file.size();
+        return image_file.substr(0, dot) + "." + std::to_string(page) + image_file.substr(dot);
+    }
+
+    bool TextureAtlas::LoadCache(const std::string &cache_file, const std::string &image_file, std::time_t desc_time_modified)
+    {
+        try
+        {
+            bool cache_ok;
+            auto info = Filesystem::GetObjectInfo(cache_file, &cache_ok);
+            if (!cache_ok || info.category != Filesystem::file)
+                return false;
+
+            Stream::ReadOnlyData file(cache_file);
+            const std::uint8_t *cur = file.data();
+            const std::uint8_t *end = cur + file.size();
+
+            auto NeedBytes = [&](std::size_t count)
+            {
+                if (std::size_t(end - cur) < count)
+                    Program::Error("Texture atlas cache `", cache_file, "` is truncated.");
+            };
+            auto ReadInt = [&]<typename T>(Meta::tag<T>) -> T
+            {
+                NeedBytes(sizeof(T));
+                T ret = Memory::ReadLittle<T>(cur);
+                cur += sizeof(T);
+                return ret;
+            };
+
+            NeedBytes(cache_magic.size());
+            if (std::string_view((const char *)cur, cache_magic.size()) != cache_magic)
+                return false;
+            cur += cache_magic.size();
+            if (ReadInt(Meta::tag<std::uint32_t>{}) != cache_version)
+                return false;
+
+            // Stale if the description was changed after the cache was made.
+            if (ReadInt(Meta::tag<std::int64_t>{}) != desc_time_modified)
+                return false;
+
+            ivec2 page_size;
+            page_size.x = ReadInt(Meta::tag<std::int32_t>{});
+            page_size.y = ReadInt(Meta::tag<std::int32_t>{});
+            std::uint32_t page_count = ReadInt(Meta::tag<std::uint32_t>{});
+            if ((page_size <= 0).any() || (page_size > max_cached_page_size).any() || page_count < 1)
+                return false;
+
+            // Stale if any of the pages was changed after the cache was made, or is missing.
+            for (std::uint32_t i = 0; i < page_count; i++)
+            {
+                std::int64_t time_modified = ReadInt(Meta::tag<std::int64_t>{});
+                bool page_ok;
+                auto page_info = Filesystem::GetObjectInfo(PageFileName(image_file, i), &page_ok);
+                if (!page_ok || page_info.category != Filesystem::file || page_info.time_modified != time_modified)
+                    return false;
+            }
+
+            std::uint32_t region_count = ReadInt(Meta::tag<std::uint32_t>{});
+
+            Desc new_desc;
+            new_desc.pages = page_count;
+            for (std::uint32_t i = 0; i < region_count; i++)
+            {
+                std::uint32_t name_len = ReadInt(Meta::tag<std::uint32_t>{});
+                NeedBytes(name_len);
+                std::string name((const char *)cur, name_len);
+                cur += name_len;
+
+                ImageDesc image_desc;
+                image_desc.pos.x = ReadInt(Meta::tag<std::int32_t>{});
+                image_desc.pos.y = ReadInt(Meta::tag<std::int32_t>{});
+                image_desc.size.x = ReadInt(Meta::tag<std::int32_t>{});
+                image_desc.size.y = ReadInt(Meta::tag<std::int32_t>{});
+                image_desc.page = ReadInt(Meta::tag<std::int32_t>{});
+                if (image_desc.page < 0 || std::uint32_t(image_desc.page) >= page_count)
+                    return false;
+                new_desc.images.try_emplace(std::move(name), image_desc);
+            }
+
+            // The pixels are copied directly from the file, no decoding needed.
+            // The page size is limited above, so this doesn't overflow. The division protects against overflow in the total size.
+            std::size_t page_bytes = std::size_t(page_size.x) * std::size_t(page_size.y) * sizeof(u8vec4);
+            if (page_count > std::size_t(end - cur) / page_bytes)
+                Program::Error("Texture atlas cache `", cache_file, "` is truncated.");
+            std::vector<Image> new_pages;
+            for (std::uint32_t i = 0; i < page_count; i++)
+            {
+                new_pages.push_back(Image(page_size, cur));
+                cur += page_bytes;
+            }
+
+            desc = std::move(new_desc);
+            pages = std::move(new_pages);
+            return true;
+        }
+        catch (...)
+        {
+            return false; // A broken cache is not an error, we can always load the atlas itself.
+        }
+    }
+
+    void TextureAtlas::SaveCache(const std::string &cache_file, const std::string &image_file, const std::string &desc_file) const
+    {
+        Stream::Output output(cache_file);
+        output.WriteString(cache_magic.data(), cache_magic.size());
+        output.WriteLittle<std::uint32_t>(cache_version);
+        output.WriteLittle<std::int64_t>(Filesystem::GetObjectInfo(desc_file).time_modified);
+
+        ivec2 page_size = pages.front().Size();
+        output.WriteLittle<std::int32_t>(page_size.x);
+        output.WriteLittle<std::int32_t>(page_size.y);
+        output.WriteLittle<std::uint32_t>(pages.size());
+        for (std::size_t i = 0; i < pages.size(); i++)
+            output.WriteLittle<std::int64_t>(Filesystem::GetObjectInfo(PageFileName(image_file, i)).time_modified);
+
+        output.WriteLittle<std::uint32_t>(desc.images.size());
+        for (const auto &[name, image_desc] : desc.images)
+        {
+            output.WriteLittle<std::uint32_t>(name.size());
+            output.WriteString(name.data(), name.size());
+            output.WriteLittle<std::int32_t>(image_desc.pos.x);
+            output.WriteLittle<std::int32_t>(image_desc.pos.y);
+            output.WriteLittle<std::int32_t>(image_desc.size.x);
+            output.WriteLittle<std::int32_t>(image_desc.size.y);
+            output.WriteLittle<std::int32_t>(image_desc.page);
+        }
+
+        for (const Image &page : pages)
+        {
+            ASSERT(page.Size() == page_size, "Texture atlas pages have different sizes.");
+            output.WriteBytes(page.Data(), std::size_t(page_size.prod()) * sizeof(u8vec4));
+        }
+
+        output.Flush();
+    }
+
     TextureAtlas::TextureAtlas(ivec2 target_size, const std::string &source_dir, const std::string &out_image_file, const std::string &out_desc_file, const std::map<std::string, ivec2> &artifical_regions, bool add_gaps)
         : source_dir(source_dir)
     {
@@ -55,14 +205,20 @@ namespace Graphics
         }
 
 
+        std::string cache_file = out_desc_file + ".cache";
+
         // Decide if we should load the atlas or regenerate it.
         if (!allow_regeneration || source_tree.time_modified_recursive < min(image_time_modified, desc_time_modified))
         {
             // Try loading the existing atlas because either regeneration is disabled, or atlas image and description are new enough.
             try
             {
+                // Try the binary cache first. It's only used if the image and the description weren't changed since it was made.
+                bool loaded_from_cache = image_time_modified != 0 && desc_time_modified != 0 && LoadCache(cache_file, out_image_file, desc_time_modified);
+
                 // Load and parse description.
-                Refl::FromString(desc, Stream::Input(out_desc_file));
+                if (!loaded_from_cache)
+                    Refl::FromString(desc, Stream::Input(out_desc_file));
 
                 // Make sure that all requested artifical regions are present in the atlas. If not, attempt to regenerate it.
                 for (const auto &[name, size] : artifical_regions)
@@ -72,8 +228,23 @@ namespace Graphics
                         Program::Error("The texture atlas doesn't include some of the requested artifical regions.");
                 }
 
-                // Load image.
-                image = Image(out_image_file);
+                if (desc.pages < 1)
+                    Program::Error("The texture atlas description has no pages.");
+
+                if (!loaded_from_cache)
+                {
+                    // Load images.
+                    pages.clear();
+                    for (int i = 0; i < desc.pages; i++)
+                        pages.push_back(Image(PageFileName(out_image_file, i)));
+
+                    // Update the cache.
+                    try
+                    {
+                        SaveCache(cache_file, out_image_file, out_desc_file);
+                    }
+                    catch (...) {}
+                }
 
                 return; // The atlas was loaded successfully.
             }
@@ -89,43 +260,109 @@ namespace Graphics
 
         // Begin regenerating atlas.
 
-        // Count images.
-        int image_count = artifical_regions.size();
+        std::string manifest_file = out_desc_file + ".manifest";
+
+        // Try loading the previous atlas along with its manifest, to reuse the unchanged images.
+        Manifest old_manifest;
+        Desc old_desc;
+        bool have_old_atlas = false;
+        try
+        {
+            Refl::FromString(old_manifest, Stream::Input(manifest_file));
+            if (old_manifest.target_size == target_size && old_manifest.add_gaps == add_gaps)
+            {
+                Refl::FromString(old_desc, Stream::Input(out_desc_file));
+                pages.clear();
+                for (int i = 0; i < old_desc.pages; i++)
+                    pages.push_back(Image(PageFileName(out_image_file, i)));
+                have_old_atlas = !pages.empty() && std::all_of(pages.begin(), pages.end(), [&](const Image &page){return page.Size() == target_size;});
+            }
+        }
+        catch (...) {}
+
+        // List image files.
+        std::vector<const Filesystem::TreeNode *> file_list;
         Filesystem::ForEachObject(source_tree, [&](const Filesystem::TreeNode &node)
         {
             if (node.info.category != Filesystem::file)
                 return;
-            image_count++;
+            file_list.push_back(&node);
         });
 
+        int image_count = artifical_regions.size() + file_list.size();
+
         // Load images.
         struct Elem
         {
             std::string name;
             Image image;
+            ivec2 size = ivec2(0); // Same as `image.Size()`, but is also set if the image is unchanged and wasn't loaded.
+
+            const Filesystem::TreeNode *file = nullptr; // Null for artifical regions.
+            ManifestEntry manifest_entry;
+
+            // True if this image is already in the old atlas, so `image` wasn't loaded.
+            bool unchanged = false;
         };
-        std::vector<Elem> elem_list;
-        elem_list.reserve(image_count);
+        std::vector<Elem> elem_list(image_count);
 
-        for (const auto &[name, size] : artifical_regions)
+        auto artifical_region_it = artifical_regions.begin();
+        for (size_t i = 0; i < artifical_regions.size(); i++, artifical_region_it++)
         {
-            auto &new_elem = elem_list.emplace_back();
-            new_elem.name = name;
-            new_elem.image = Image(size);
+            Elem &elem = elem_list[i];
+            elem.name = artifical_region_it->first;
+            elem.size = artifical_region_it->second;
+
+            if (have_old_atlas)
+            {
+                auto it = old_desc.images.find(elem.name);
+                elem.unchanged = it != old_desc.images.end() && it->second.size == elem.size;
+            }
+
+            if (!elem.unchanged)
+                elem.image = Image(elem.size);
         }
 
-        Filesystem::ForEachObject(source_tree, [&](const Filesystem::TreeNode &node)
+        // Decoding is the slow part, so it's done in parallel. Each thread writes only to its own elements.
+        Parallel::ForEachIndex(file_list.size(), [&](size_t i)
         {
-            if (node.info.category != Filesystem::file)
-                return;
-
-            auto &new_elem = elem_list.emplace_back();
+            Elem &elem = elem_list[artifical_regions.size() + i];
+            elem.file = file_list[i];
 
             // Save image name, but first strip source directory name from it.
-            new_elem.name = node.path.substr(source_dir.size() + 1); // `+ 1` is for `/`.
+            elem.name = elem.file->path.substr(source_dir.size() + 1); // `+ 1` is for `/`.
+
+            elem.manifest_entry.time_modified = elem.file->info.time_modified;
+
+            // Check if the image is unchanged, first by the modification time, then by the contents.
+            auto old_entry = old_manifest.images.end();
+            auto old_desc_entry = old_desc.images.end();
+            if (have_old_atlas)
+            {
+                old_entry = old_manifest.images.find(elem.name);
+                old_desc_entry = old_desc.images.find(elem.name);
+                if (old_entry != old_manifest.images.end() && old_desc_entry != old_desc.images.end() && old_entry->second.time_modified == elem.manifest_entry.time_modified)
+                {
+                    elem.manifest_entry.hash = old_entry->second.hash;
+                    elem.size = old_desc_entry->second.size;
+                    elem.unchanged = true;
+                    return;
+                }
+            }
+
+            Stream::ReadOnlyData file(elem.file->path);
+            elem.manifest_entry.hash = Hash::Bytes(file.data(), file.size());
+
+            if (old_entry != old_manifest.images.end() && old_desc_entry != old_desc.images.end() && old_entry->second.hash == elem.manifest_entry.hash)
+            {
+                elem.size = old_desc_entry->second.size;
+                elem.unchanged = true;
+                return;
+            }
 
             // Load image.
-            new_elem.image = Image(node.path);
+            elem.image = Image(file);
+            elem.size = elem.image.Size();
         });
 
         // Sort images by name. Otherwise the order sometimes turns out different on different platforms.
@@ -135,32 +372,131 @@ namespace Graphics
         std::vector<Packing::Rect> rect_list;
         rect_list.reserve(image_count);
         for (const Elem &elem : elem_list)
-            rect_list.push_back(elem.image.Size());
+            rect_list.push_back(elem.size);
 
-        // Try packing rectangles.
-        if (Packing::PackRects(target_size, rect_list.data(), rect_list.size(), add_gaps))
-            Program::Error("Unable to fit texture atlas for `", source_dir, "` into a ", target_size.x, 'x', target_size.y, " texture.");
+        // Try placing only the new and resized images, keeping the rest in place.
+        bool packed_incrementally = false;
+        if (have_old_atlas)
+        {
+            std::vector<std::vector<Packing::Rect>> kept_rects(pages.size()); // Per page.
+            std::vector<size_t> new_indices;
+            for (size_t i = 0; i < elem_list.size(); i++)
+            {
+                auto it = old_desc.images.find(elem_list[i].name);
+                if (it != old_desc.images.end() && it->second.size == elem_list[i].size && it->second.page >= 0 && it->second.page < int(pages.size()))
+                {
+                    rect_list[i].pos = it->second.pos;
+                    rect_list[i].page = it->second.page;
+                    kept_rects[it->second.page].push_back(rect_list[i]);
+                }
+                else
+                {
+                    new_indices.push_back(i);
+                }
+            }
 
-        // Construct description and final image.
-        image = Image(target_size, u8vec4(0));
+            // Fill the free space on each page in order. What doesn't fit goes to the next page.
+            for (int page = 0; page < int(pages.size()) && !new_indices.empty(); page++)
+            {
+                std::vector<Packing::Rect> new_rects;
+                for (size_t index : new_indices)
+                    new_rects.push_back(rect_list[index].size);
+
+                Packing::PackRectsAround(target_size, kept_rects[page].data(), kept_rects[page].size(), new_rects.data(), new_rects.size(), add_gaps);
+
+                std::vector<size_t> not_packed;
+                for (size_t i = 0; i < new_indices.size(); i++)
+                {
+                    if (new_rects[i].was_packed)
+                    {
+                        rect_list[new_indices[i]].pos = new_rects[i].pos;
+                        rect_list[new_indices[i]].page = page;
+                    }
+                    else
+                    {
+                        not_packed.push_back(new_indices[i]);
+                    }
+                }
+                new_indices = std::move(not_packed);
+            }
+
+            if (new_indices.empty())
+            {
+                packed_incrementally = true;
+
+                // Erase the images that were removed or changed.
+                for (const auto &[name, old_image_desc] : old_desc.images)
+                {
+                    if (old_image_desc.page < 0 || old_image_desc.page >= int(pages.size()))
+                        continue;
+                    auto it = std::lower_bound(elem_list.begin(), elem_list.end(), name, [](const Elem &elem, const std::string &name){return elem.name < name;});
+                    const Packing::Rect *rect = it == elem_list.end() || it->name != name ? nullptr : &rect_list[it - elem_list.begin()];
+                    if (!rect || !it->unchanged || rect->pos != old_image_desc.pos || rect->page != old_image_desc.page)
+                        pages[old_image_desc.page].UnsafeFill(old_image_desc.pos, old_image_desc.size, u8vec4(0));
+                }
+            }
+        }
+
+        if (!packed_incrementally)
+        {
+            // The new images don't fit into the free space, or there's no old atlas. Repack everything, adding more pages if necessary.
+            // The unchanged images weren't loaded, so load them now.
+            Parallel::ForEachIndex(elem_list.size(), [&](size_t i)
+            {
+                Elem &elem = elem_list[i];
+                if (!elem.unchanged)
+                    return;
+                elem.image = elem.file ? Image(elem.file->path) : Image(elem.size);
+                elem.size = elem.image.Size();
+                elem.unchanged = false;
+            });
+            for (size_t i = 0; i < elem_list.size(); i++)
+                rect_list[i] = Packing::Rect(elem_list[i].size);
+
+            // Pack rectangles. The regions are drawn without rotation, so it's disabled.
+            Packing::Options options;
+            options.heuristic = Packing::Heuristic::max_rects_best_short_side;
+            options.inner_gaps = add_gaps;
+            options.max_pages = -1;
+            Packing::Result result = Packing::Pack(target_size, rect_list.data(), rect_list.size(), options);
+            if (result.rects_not_packed)
+                Program::Error("Unable to fit texture atlas for `", source_dir, "` into ", target_size.x, 'x', target_size.y, " pages: ", result.rects_not_packed, " images are too large.");
+
+            pages.assign(std::max(result.pages, 1), Image(target_size, u8vec4(0)));
+        }
+
+        // Construct description and manifest.
         desc = {}; // In case we started populating it and failed.
+        desc.pages = pages.size();
+        Manifest manifest;
+        manifest.target_size = target_size;
+        manifest.add_gaps = add_gaps;
         for (size_t i = 0; i < elem_list.size(); i++)
         {
             // Add image to description.
             ImageDesc image_desc;
             image_desc.pos = rect_list[i].pos;
-            image_desc.size = elem_list[i].image.Size(); // Note that we don't extract sizes from rectangles, since those sizes might include gap size.
-            if (!desc.images.insert({std::move(elem_list[i].name), image_desc}).second)
+            image_desc.size = elem_list[i].size; // Note that we don't extract sizes from rectangles, since those sizes might include gap size.
+            image_desc.page = rect_list[i].page;
+            if (!desc.images.insert({elem_list[i].name, image_desc}).second)
                 Program::Error("Internal error while generating description for texture atlas for `", source_dir, "`: Duplicate image paths.");
 
-            // Copy this image to target image.
-            image.UnsafeDrawImage(elem_list[i].image, image_desc.pos);
+            if (elem_list[i].file)
+                manifest.images.try_emplace(elem_list[i].name, elem_list[i].manifest_entry);
         }
 
-        // Save final image.
+        // Copy the changed images to the target image. The rectangles don't overlap, so this can be done in parallel.
+        Parallel::ForEachIndex(elem_list.size(), [&](size_t i)
+        {
+            if (!elem_list[i].unchanged)
+                pages[rect_list[i].page].UnsafeDrawImage(elem_list[i].image, rect_list[i].pos);
+        });
+
+        // Save final images.
         try
         {
-            image.Save(out_image_file);
+            for (size_t i = 0; i < pages.size(); i++)
+                pages[i].Save(PageFileName(out_image_file, i));
         }
         catch (...) {}
 
@@ -171,5 +507,20 @@ namespace Graphics
             Stream::SaveFile(out_desc_file, desc_string, Stream::text);
         }
         catch (...) {}
+
+        // Save manifest.
+        try
+        {
+            std::string manifest_string = Refl::ToString(manifest, Refl::ToStringOptions::Pretty());
+            Stream::SaveFile(manifest_file, manifest_string, Stream::text);
+        }
+        catch (...) {}
+
+        // Save cache. This must be done last, since it remembers the modification times of the image and the description.
+        try
+        {
+            SaveCache(cache_file, out_image_file, out_desc_file);
+        }
+        catch (...) {}
     }
 }
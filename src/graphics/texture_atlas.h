@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <ctime>
 #include <map>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -20,21 +22,56 @@ namespace Graphics
     {
         REFL_SIMPLE_STRUCT_WITHOUT_NAMES( ImageDesc
             REFL_DECL(ivec2) pos, size
+            REFL_DECL(int) page
         )
 
         REFL_SIMPLE_STRUCT( Desc
+            REFL_DECL(int) pages
             REFL_DECL(std::map<std::string, ImageDesc>) images
         )
 
-        Image image;
+        // Stored next to the description, lets us skip unchanged images when regenerating the atlas.
+        REFL_SIMPLE_STRUCT_WITHOUT_NAMES( ManifestEntry
+            REFL_DECL(std::uint64_t) hash // `Hash::Bytes()` of the image file.
+            REFL_DECL(std::int64_t) time_modified // If this matches, we don't even read the file.
+        )
+
+        REFL_SIMPLE_STRUCT( Manifest
+            REFL_DECL(ivec2) target_size
+            REFL_DECL(bool) add_gaps
+            REFL_DECL(std::map<std::string, ManifestEntry>) images
+        )
+
+        std::vector<Image> pages;
         Desc desc;
         std::string source_dir;
 
+        // The binary cache, saved next to the description as `<out_desc_file>.cache`. It's a copy of the atlas that loads without parsing and decoding.
+        // The format is:
+        //     "IMPATLAS", the version (u32), the modification time of the description at the moment the cache was made (i64),
+        //     the page size (2 x i32), the page count (u32), the modification times of the page images (i64 each), the region count (u32),
+        //     then the regions: the name length (u32), the name, the position, size (2 x i32 each) and the page index (i32),
+        //     then the uncompressed RGBA pixels of every page, in the same order as in `Image`.
+        // All numbers are little-endian.
+        static constexpr std::string_view cache_magic = "IMPATLAS";
+        static constexpr std::uint32_t cache_version = 2;
+        // Larger pages in the cache are considered broken. This also keeps the size computations from overflowing.
+        static constexpr int max_cached_page_size = 0x8000;
+
+        // Returns false if the cache is missing, stale or broken.
+        [[nodiscard]] bool LoadCache(const std::string &cache_file, const std::string &image_file, std::time_t desc_time_modified);
+        // Throws on failure.
+        void SaveCache(const std::string &cache_file, const std::string &image_file, const std::string &desc_file) const;
+
+        // Returns the file name for the specified page. Page 0 uses `image_file` as is, the other pages get the index inserted before the extension.
+        [[nodiscard]] static std::string PageFileName(const std::string &image_file, int page);
+
       public:
         struct Region
         {
             ivec2 pos = ivec2(0);
             ivec2 size = ivec2(0);
+            int page = 0; // The index of the image from `GetImage()` that contains this region.
 
             Region() {}
 
@@ -43,6 +80,7 @@ namespace Graphics
                 Region ret;
                 ret.pos = pos + sub_pos;
                 ret.size = sub_size;
+                ret.page = page;
                 return ret;
             }
 
@@ -51,6 +89,7 @@ namespace Graphics
                 Region ret;
                 ret.pos = pos + m;
                 ret.size = size - 2 * m;
+                ret.page = page;
                 return ret;
             }
         };
@@ -77,8 +116,13 @@ namespace Graphics
 
         TextureAtlas() {}
 
+        // `target_size` is the size of a single page. If the images don't fit into one page, more pages are added,
+        //   and saved next to `out_image_file` with the page index inserted before the extension.
         // Pass empty string as `source_dir` to disallow regeneration.
         // `artifical_regions` are empty "images" that are added to the atlas.
+        // The loaded atlas is also saved to a binary cache, which is used instead of the image and the description if they don't change.
+        // When regenerating, a manifest of image hashes is saved to `<out_desc_file>.manifest`. Next time only the changed images are reloaded,
+        //   and they are placed into the free space without moving the rest. Everything is repacked only if they don't fit.
         TextureAtlas(ivec2 target_size, const std::string &source_dir, const std::string &out_image_file, const std::string &out_desc_file, const std::map<std::string, ivec2> &artifical_regions = {}, bool add_gaps = true);
 
         [[nodiscard]] const std::string &SourceDirectory() const
@@ -86,13 +130,30 @@ namespace Graphics
             return source_dir;
         }
 
-        [[nodiscard]] Image &GetImage()
+        [[nodiscard]] int PageCount() const
         {
-            return image;
+            return pages.size();
         }
-        [[nodiscard]] const Image &GetImage() const
+
+        [[nodiscard]] Image &GetImage(int page = 0)
+        {
+            return const_cast<Image &>(std::as_const(*this).GetImage(page));
+        }
+        [[nodiscard]] const Image &GetImage(int page = 0) const
+        {
+            ASSERT(page >= 0 && page < PageCount(), "Texture atlas page index is out of range.");
+            return pages[page];
+        }
+
+        // The total area of the images divided by the total area of the pages, in range 0..1.
+        [[nodiscard]] float PackingEfficiency() const
         {
-            return image;
+            if (pages.empty())
+                return 0;
+            double used_area = 0;
+            for (const auto &[name, image_desc] : desc.images)
+                used_area += image_desc.size.prod();
+            return used_area / (double(pages.front().Size().prod()) * pages.size());
         }
 
         [[nodiscard]] bool GetOpt(const std::string &name, Region &target) const // Returns false if no such image.
@@ -103,6 +164,7 @@ namespace Graphics
 
             target.pos = it->second.pos;
             target.size = it->second.size;
+            target.page = it->second.page;
             return true;
         }
 
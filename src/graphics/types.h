@@ -3,6 +3,7 @@
 #include <string>
 #include <type_traits>
 
+#include "graphics/buffer_texture.h"
 #include "graphics/texture.h"
 #include "utils/mat.h"
 
@@ -44,6 +45,7 @@ namespace Graphics
             return ret;
         }
         else if constexpr (std::is_same_v<T, TexUnit     >) return "sampler2D";
+        else if constexpr (std::is_same_v<T, BufferTexture>) return "samplerBuffer";
         else if constexpr (std::is_same_v<T, bool        >) return "bool";
         else if constexpr (std::is_same_v<T, float       >) return "float";
         else if constexpr (std::is_same_v<T, double      >) return "double";
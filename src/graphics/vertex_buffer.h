@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -145,6 +146,34 @@ namespace Graphics
         {
             return binding_draw;
         }
+
+        // Returns true if the context supports sync objects (GL 3.2, or `GL_ARB_sync`), so streaming buffers can use `Fence` to tell if the GPU still reads them.
+        // Needs a current context. The result is computed once and cached.
+        [[nodiscard]] static bool SyncSupported()
+        {
+            #ifdef glFenceSync
+            static const bool ret = []{
+                GLint major = 0, minor = 0;
+                glGetIntegerv(GL_MAJOR_VERSION, &major);
+                glGetIntegerv(GL_MINOR_VERSION, &minor);
+                if (major > 3 || (major == 3 && minor >= 2))
+                    return true;
+
+                GLint extension_count = 0;
+                glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+                for (GLint i = 0; i < extension_count; i++)
+                {
+                    const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+                    if (name && std::string_view(name) == "GL_ARB_sync")
+                        return true;
+                }
+                return false;
+            }();
+            return ret;
+            #else
+            return false;
+            #endif
+        }
     };
 
     template <typename T>
@@ -249,6 +278,11 @@ namespace Graphics
             glBufferData(GL_ARRAY_BUFFER, count * sizeof(T), source, usage);
             data.size = count;
         }
+        // Replaces the storage with a new uninitialized one of the same size, so that writing to it doesn't have to wait for the GPU to finish reading the old one.
+        void Orphan(Usage usage = stream_draw) // Binds storage.
+        {
+            SetData(data.size, nullptr, usage);
+        }
         void SetDataPart(int elem_offset, int elem_count, const T *source) // Binds storage.
         {
             SetDataPartBytes(elem_offset * sizeof(T), elem_count * sizeof(T), (const uint8_t *)source);
@@ -279,5 +313,21 @@ namespace Graphics
         {
             Draw(m, 0, Size());
         }
+
+        #ifdef glDrawArraysInstanced
+        void DrawInstanced(DrawMode m, int offset, int count, int instances) const // Binds for drawing.
+        {
+            static_assert(is_reflected, "Element type of this buffer is not reflected, unable to draw.");
+            ASSERT(*this, "Attempt to use a null vertex buffer.");
+            if (!*this)
+                return;
+            BindDraw();
+            glDrawArraysInstanced(m, offset, count, instances);
+        }
+        void DrawInstanced(DrawMode m, int count, int instances) const // Binds for drawing.
+        {
+            DrawInstanced(m, 0, count, instances);
+        }
+        #endif
     };
 }
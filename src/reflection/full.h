@@ -10,4 +10,6 @@
 #include "reflection/interface_std_string.h"
 #include "reflection/interface_std_variant.h"
 #include "reflection/interface_struct.h"
+#include "reflection/metadata_delta_timeline.h"
 #include "reflection/metadata_multiarray.h"
+#include "reflection/metadata_ring_buffer.h"
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+
+#include "program/errors.h"
+#include "reflection/interface_struct.h"
+#include "utils/delta_timeline.h"
+
+// Only the encoded data is serialized. The last state and the cursor are restored after deserialization.
+template <typename Codec, int KeyframeInterval> struct DeltaTimeline<Codec, KeyframeInterval>::ReflHelper
+{
+    using timeline_t = DeltaTimeline<Codec, KeyframeInterval>;
+
+    static auto &GetKeyframeWords(timeline_t &timeline)
+    {
+        return timeline.keyframe_words;
+    }
+
+    static auto &GetKeyframeBitOffsets(timeline_t &timeline)
+    {
+        return timeline.keyframe_bit_offsets;
+    }
+
+    static auto &GetBits(timeline_t &timeline)
+    {
+        return timeline.bits;
+    }
+
+    static auto &GetBitSize(timeline_t &timeline)
+    {
+        return timeline.bit_size;
+    }
+
+    static auto &GetSize(timeline_t &timeline)
+    {
+        return timeline.size;
+    }
+
+    static void CheckInvariant(const timeline_t &object)
+    {
+        if (object.size < 0)
+            Program::Error("Delta timeline can't have a negative size.");
+
+        std::size_t num_keyframes = (object.size + KeyframeInterval - 1) / KeyframeInterval;
+        if (object.keyframe_bit_offsets.size() != num_keyframes || object.keyframe_words.size() != num_keyframes * word_count)
+            Program::Error("Delta timeline keyframe count doesn't match its size.");
+
+        if (object.bits.size() != (object.bit_size + 63) / 64)
+            Program::Error("Delta timeline bit count doesn't match the storage size.");
+
+        for (std::size_t i = 0; i < num_keyframes; i++)
+        {
+            if (object.keyframe_bit_offsets[i] > object.bit_size || (i > 0 && object.keyframe_bit_offsets[i] < object.keyframe_bit_offsets[i-1]))
+                Program::Error("Delta timeline keyframe offsets are invalid.");
+        }
+    }
+
+    static void RestoreCache(timeline_t &object)
+    {
+        object.cursor.index = -1;
+        if (object.size > 0)
+            object.last = object.SeekCursor(object.size - 1);
+    }
+};
+
+namespace Refl::Class::Custom
+{
+    template <typename Codec, int KeyframeInterval> struct name<DeltaTimeline<Codec, KeyframeInterval>>
+    {
+        static constexpr const char *value = "DeltaTimeline";
+    };
+    template <typename Codec, int KeyframeInterval> struct members<DeltaTimeline<Codec, KeyframeInterval>>
+    {
+        using helper = typename DeltaTimeline<Codec, KeyframeInterval>::ReflHelper;
+
+        static constexpr std::size_t count = 5;
+        template <std::size_t I> static constexpr auto &at(DeltaTimeline<Codec, KeyframeInterval> &object)
+        {
+            if constexpr (I == 0)
+                return helper::GetKeyframeWords(object);
+            else if constexpr (I == 1)
+                return helper::GetKeyframeBitOffsets(object);
+            else if constexpr (I == 2)
+                return helper::GetBits(object);
+            else if constexpr (I == 3)
+                return helper::GetBitSize(object);
+            else
+                return helper::GetSize(object);
+        }
+    };
+}
+
+template <typename Codec, int KeyframeInterval>
+struct Refl::StructCallbacks<DeltaTimeline<Codec, KeyframeInterval>> : Refl::DefaultStructCallbacks<DeltaTimeline<Codec, KeyframeInterval>>
+{
+    using helper = typename DeltaTimeline<Codec, KeyframeInterval>::ReflHelper;
+
+    static void PreSerialize(const DeltaTimeline<Codec, KeyframeInterval> &object)
+    {
+        helper::CheckInvariant(object);
+    }
+    static void PostDeserialize(DeltaTimeline<Codec, KeyframeInterval> &object)
+    {
+        helper::CheckInvariant(object);
+        helper::RestoreCache(object);
+    }
+};
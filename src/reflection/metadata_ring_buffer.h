@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+
+#include "program/errors.h"
+#include "reflection/interface_struct.h"
+#include "utils/ring_buffer.h"
+
+template <typename T> struct RingBuffer<T>::ReflHelper
+{
+    static auto &GetStorage(RingBuffer<T> &buffer)
+    {
+        return buffer.storage;
+    }
+
+    static auto &GetBegin(RingBuffer<T> &buffer)
+    {
+        return buffer.begin;
+    }
+
+    static auto &GetSize(RingBuffer<T> &buffer)
+    {
+        return buffer.size;
+    }
+
+    static void CheckInvariant(const RingBuffer<T> &object)
+    {
+        std::size_t capacity = object.storage.size();
+
+        if (capacity & (capacity - 1))
+            Program::Error("Ring buffer capacity must be a power of two.");
+
+        if (capacity == 0 ? object.begin != 0 : object.begin >= capacity)
+            Program::Error("Ring buffer starting index is out of range.");
+
+        if (object.size > capacity)
+            Program::Error("Ring buffer size exceeds its capacity.");
+    }
+};
+
+namespace Refl::Class::Custom
+{
+    template <typename T> struct name<RingBuffer<T>>
+    {
+        static constexpr const char *value = "RingBuffer";
+    };
+    template <typename T> struct members<RingBuffer<T>>
+    {
+        static constexpr std::size_t count = 3;
+        template <std::size_t I> static constexpr auto &at(RingBuffer<T> &object)
+        {
+            if constexpr (I == 0)
+                return RingBuffer<T>::ReflHelper::GetStorage(object);
+            else if constexpr (I == 1)
+                return RingBuffer<T>::ReflHelper::GetBegin(object);
+            else
+                return RingBuffer<T>::ReflHelper::GetSize(object);
+        }
+    };
+}
+
+template <typename T>
+struct Refl::StructCallbacks<RingBuffer<T>> : Refl::DefaultStructCallbacks<RingBuffer<T>>
+{
+    static void PreSerialize(const RingBuffer<T> &object)
+    {
+        RingBuffer<T>::ReflHelper::CheckInvariant(object);
+    }
+    static void PostDeserialize(RingBuffer<T> &object)
+    {
+        RingBuffer<T>::ReflHelper::CheckInvariant(object);
+    }
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "program/errors.h"
+
+// A compact append-only sequence of fixed-size states, optimized for sequences where consecutive states are similar.
+// Every `KeyframeInterval`-th state is stored verbatim (a keyframe), and the rest are stored as bit-packed XORs with the previous state.
+// Each state is converted to `Codec::size` 32-bit words. For every state we store a single bit if nothing changed, otherwise a mask of changed words,
+//   and for each changed word we store its XOR with the previous value, with leading and trailing zeroes stripped (similar to the "Gorilla" float compression).
+// Random access decodes at most `KeyframeInterval - 1` deltas. Accessing consecutive states in ascending order is O(1), thanks to a cached cursor.
+// The cursor also remembers the last `window_size` decoded states, so reading a few states around the current one is O(1) too,
+//   and walking backwards decodes from a keyframe only once per `window_size` states.
+//
+// `Codec` must look like this:
+//     struct MyCodec
+//     {
+//         using type = MyState;
+//         static constexpr std::size_t size = 4; // The number of words.
+//         static void Pack(const MyState &state, std::uint32_t *words);
+//         static void Unpack(MyState &state, const std::uint32_t *words);
+//     };
+template <typename Codec, int KeyframeInterval = 32>
+class DeltaTimeline
+{
+    static_assert(KeyframeInterval >= 1, "The keyframe interval must be positive.");
+
+  public:
+    using value_type = typename Codec::type;
+    static constexpr std::size_t word_count = Codec::size;
+    static constexpr int keyframe_interval = KeyframeInterval;
+    static constexpr int window_size = 8; // The number of recently decoded states that are cached.
+
+    static_assert(word_count >= 1 && word_count <= 64, "The amount of words must be in range 1..64.");
+
+    struct ReflHelper; // Our reflection metadata uses this to access private fields.
+
+  private:
+    using words_t = std::array<std::uint32_t, word_count>;
+
+    // The position of a decoded state, used to speed up sequential access.
+    struct Cursor
+    {
+        int index = -1; // -1 if the cursor is invalid.
+        std::size_t bit_offset = 0; // Where the delta for `index + 1` starts.
+        words_t words{};
+
+        // The recently decoded states, from `window_begin` to `index` inclusive. State `i` is stored at `window[i % window_size]`.
+        std::array<words_t, window_size> window{};
+        int window_begin = 0;
+    };
+
+    // The keyframes. `word_count` words per keyframe, concatenated.
+    std::vector<std::uint32_t> keyframe_words;
+    // For each keyframe, where the deltas for the following states start.
+    std::vector<std::size_t> keyframe_bit_offsets;
+
+    std::vector<std::uint64_t> bits;
+    std::size_t bit_size = 0;
+    int size = 0;
+    words_t last{}; // The last appended state.
+
+    mutable Cursor cursor;
+
+    void WriteBits(std::uint64_t value, int count)
+    {
+        if (count == 0)
+            return;
+        if (count < 64)
+            value &= (std::uint64_t(1) << count) - 1;
+
+        std::size_t word_index = bit_size / 64;
+        int bit_index = bit_size % 64;
+        if (word_index >= bits.size())
+            bits.push_back(0);
+        bits[word_index] |= value << bit_index;
+        if (bit_index + count > 64)
+            bits.push_back(value >> (64 - bit_index));
+
+        bit_size += count;
+    }
+
+    [[nodiscard]] std::uint64_t ReadBits(std::size_t &offset, int count) const
+    {
+        if (count == 0)
+            return 0;
+
+        std::size_t word_index = offset / 64;
+        int bit_index = offset % 64;
+        std::uint64_t ret = bits[word_index] >> bit_index;
+        if (bit_index + count > 64)
+            ret |= bits[word_index + 1] << (64 - bit_index);
+        if (count < 64)
+            ret &= (std::uint64_t(1) << count) - 1;
+
+        offset += count;
+        return ret;
+    }
+
+    void WriteDelta(const words_t &prev, const words_t &next)
+    {
+        std::uint64_t mask = 0;
+        for (std::size_t i = 0; i < word_count; i++)
+        {
+            if (prev[i] != next[i])
+                mask |= std::uint64_t(1) << i;
+        }
+
+        WriteBits(mask != 0, 1);
+        if (!mask)
+            return;
+
+        WriteBits(mask, word_count);
+
+        for (std::size_t i = 0; i < word_count; i++)
+        {
+            std::uint32_t x = prev[i] ^ next[i];
+            if (!x)
+                continue;
+
+            int leading = std::countl_zero(x); // 0..31
+            int trailing = std::countr_zero(x);
+            int len = 32 - leading - trailing; // 1..32
+            WriteBits(leading, 5);
+            WriteBits(len - 1, 5);
+            WriteBits(x >> trailing, len);
+        }
+    }
+
+    void ApplyDelta(words_t &words, std::size_t &offset) const
+    {
+        if (!ReadBits(offset, 1))
+            return;
+
+        std::uint64_t mask = ReadBits(offset, word_count);
+
+        while (mask)
+        {
+            int i = std::countr_zero(mask);
+            mask &= mask - 1;
+
+            int leading = ReadBits(offset, 5);
+            int len = ReadBits(offset, 5) + 1;
+            std::uint32_t x = std::uint32_t(ReadBits(offset, len)) << (32 - leading - len);
+            words[i] ^= x;
+        }
+    }
+
+    void PushWords(const words_t &words)
+    {
+        if (size % KeyframeInterval == 0)
+        {
+            keyframe_words.insert(keyframe_words.end(), words.begin(), words.end());
+            keyframe_bit_offsets.push_back(bit_size);
+        }
+        else
+        {
+            WriteDelta(last, words);
+        }
+
+        last = words;
+        size++;
+    }
+
+    // Moves the cursor to the specified state.
+    const words_t &SeekCursor(int index) const
+    {
+        ASSERT(index >= 0 && index < size, "Delta timeline index is out of range.");
+
+        if (cursor.index >= 0 && index <= cursor.index && index >= cursor.window_begin)
+            return cursor.window[index % window_size];
+
+        if (cursor.index < 0 || cursor.index > index || cursor.index / KeyframeInterval != index / KeyframeInterval)
+        {
+            std::size_t keyframe = index / KeyframeInterval;
+            int keyframe_index = index / KeyframeInterval * KeyframeInterval;
+
+            // If we're moving to the next keyframe, the window remains contiguous.
+            if (cursor.index < 0 || cursor.index != keyframe_index - 1)
+                cursor.window_begin = keyframe_index;
+
+            cursor.index = keyframe_index;
+            cursor.bit_offset = keyframe_bit_offsets[keyframe];
+            std::copy_n(keyframe_words.begin() + keyframe * word_count, word_count, cursor.words.begin());
+            cursor.window[cursor.index % window_size] = cursor.words;
+        }
+
+        while (cursor.index < index)
+        {
+            ApplyDelta(cursor.words, cursor.bit_offset);
+            cursor.index++;
+            cursor.window[cursor.index % window_size] = cursor.words;
+        }
+
+        cursor.window_begin = std::max(cursor.window_begin, cursor.index - window_size + 1);
+        return cursor.words;
+    }
+
+    // Removes all states starting from `new_size`, which must be a multiple of the keyframe interval.
+    void TruncateToKeyframe(int new_size)
+    {
+        ASSERT(new_size % KeyframeInterval == 0 && new_size <= size);
+
+        if (new_size == size)
+            return;
+
+        bit_size = keyframe_bit_offsets[new_size / KeyframeInterval];
+        keyframe_words.resize(new_size / KeyframeInterval * word_count);
+        keyframe_bit_offsets.resize(new_size / KeyframeInterval);
+        bits.resize((bit_size + 63) / 64);
+        if (bit_size % 64)
+            bits.back() &= (std::uint64_t(1) << bit_size % 64) - 1;
+
+        size = new_size;
+        cursor.index = -1;
+        // `last` is left as is, since the next state is going to be a keyframe anyway.
+    }
+
+  public:
+    DeltaTimeline() {}
+
+    // The number of states.
+    [[nodiscard]] int Size() const
+    {
+        return size;
+    }
+    [[nodiscard]] bool IsEmpty() const
+    {
+        return size == 0;
+    }
+
+    // Appends a state to the end.
+    void PushBack(const value_type &state)
+    {
+        words_t words{};
+        Codec::Pack(state, words.data());
+        PushWords(words);
+    }
+
+    // Returns the state with the specified index.
+    // This is cheap if you access states in the ascending order, or close to the previously accessed state.
+    [[nodiscard]] value_type operator[](int index) const
+    {
+        value_type ret{};
+        Codec::Unpack(ret, SeekCursor(index).data());
+        return ret;
+    }
+
+    // Returns the last state. Doesn't touch the cursor.
+    [[nodiscard]] value_type Back() const
+    {
+        ASSERT(size > 0, "Attempt to get the last state of an empty delta timeline.");
+        value_type ret{};
+        Codec::Unpack(ret, last.data());
+        return ret;
+    }
+
+    // Calls `func` on each state starting from `begin`, in order, and saves the changes.
+    // `func` is `bool func(value_type &state)`, it should return false to stop the iteration.
+    // Everything starting from the keyframe before `begin` is reencoded, so this is O(n), but mutations are supposed to be rare.
+    template <typename F>
+    void Modify(int begin, F &&func)
+    {
+        ASSERT(begin >= 0, "Delta timeline index is out of range.");
+        if (begin >= size)
+            return;
+
+        int block_begin = begin / KeyframeInterval * KeyframeInterval;
+
+        // Decode all states starting from the keyframe.
+        std::vector<words_t> states;
+        states.reserve(size - block_begin);
+        for (int i = block_begin; i < size; i++)
+            states.push_back(SeekCursor(i));
+
+        // Apply the changes.
+        for (std::size_t i = begin - block_begin; i < states.size(); i++)
+        {
+            value_type state{};
+            Codec::Unpack(state, states[i].data());
+            bool should_continue = func(state);
+            Codec::Pack(state, states[i].data());
+            if (!should_continue)
+                break;
+        }
+
+        // Reencode.
+        TruncateToKeyframe(block_begin);
+        for (const words_t &words : states)
+            PushWords(words);
+    }
+
+    // Removes all states.
+    void Clear()
+    {
+        keyframe_words.clear();
+        keyframe_bit_offsets.clear();
+        bits.clear();
+        bit_size = 0;
+        size = 0;
+        cursor.index = -1;
+    }
+
+    // Returns the approximate amount of heap memory used, in bytes.
+    [[nodiscard]] std::size_t MemoryUsage() const
+    {
+        return keyframe_words.capacity() * sizeof(std::uint32_t) + keyframe_bit_offsets.capacity() * sizeof(std::size_t) + bits.capacity() * sizeof(std::uint64_t);
+    }
+};
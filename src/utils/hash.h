@@ -2,6 +2,7 @@
 
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
 #include <tuple>
@@ -43,6 +44,18 @@ namespace Hash
         return hash;
     }
 
+    // Hashes a byte sequence, using 64-bit FNV-1a. Unlike `std::hash`, the result is stable across runs and platforms, so it can be saved to files.
+    [[nodiscard]] inline std::uint64_t Bytes(const void *data, std::size_t size)
+    {
+        std::uint64_t ret = 0xcbf29ce484222325;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            ret ^= static_cast<const unsigned char *>(data)[i];
+            ret *= 0x100000001b3;
+        }
+        return ret;
+    }
+
     // A functor that extends `std::hash` with more supported types.
     template <typename T = void>
     struct Hasher {};
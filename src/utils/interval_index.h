@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "program/errors.h"
+
+// Stores half-open intervals `[begin, end)` identified by sequential ids, and finds the intervals containing a specific point.
+// Intervals can only be appended, and their ends can move freely. Ids are assigned sequentially starting from 0.
+// The set of intervals containing a point is cached. Moving that point costs O(log(n) + k), where k is the number of interval boundaries
+//   between the old and the new point, plus the number of intervals that enter or leave the set. If the point moves by small steps, this is usually O(1).
+class IntervalIndex
+{
+    struct Interval
+    {
+        int begin = 0;
+        int end = 0;
+    };
+
+    std::vector<Interval> intervals;
+
+    // Both are sorted by the position, then by id.
+    std::set<std::pair<int, int>> begins, ends;
+
+    // Ids of intervals that have no newer intervals with smaller or equal `begin`. Their `begin`s are increasing.
+    // Used to find the newest interval that begins before a point.
+    std::vector<int> newest_candidates;
+
+    // The intervals containing `cursor_pos`, sorted by id.
+    mutable bool cursor_valid = false;
+    mutable int cursor_pos = 0;
+    mutable std::vector<int> cursor_ids;
+
+    [[nodiscard]] bool Contains(int id, int pos) const
+    {
+        const Interval &interval = intervals[id];
+        return pos >= interval.begin && pos < interval.end;
+    }
+
+    // Updates the cursor membership for a single interval.
+    void UpdateCursorFor(int id) const
+    {
+        auto it = std::lower_bound(cursor_ids.begin(), cursor_ids.end(), id);
+        bool present = it != cursor_ids.end() && *it == id;
+        bool should_be_present = Contains(id, cursor_pos);
+        if (present == should_be_present)
+            return;
+        if (should_be_present)
+            cursor_ids.insert(it, id);
+        else
+            cursor_ids.erase(it);
+    }
+
+    // Calls `UpdateCursorFor()` for every interval with a boundary in `(min, max]`.
+    void UpdateCursorInRange(const std::set<std::pair<int, int>> &boundaries, int min, int max) const
+    {
+        for (auto it = boundaries.upper_bound({min, int(intervals.size())}); it != boundaries.end() && it->first <= max; it++)
+            UpdateCursorFor(it->second);
+    }
+
+  public:
+    IntervalIndex() {}
+
+    // The number of intervals.
+    [[nodiscard]] int Size() const
+    {
+        return int(intervals.size());
+    }
+
+    [[nodiscard]] int Begin(int id) const
+    {
+        return intervals[id].begin;
+    }
+    [[nodiscard]] int End(int id) const
+    {
+        return intervals[id].end;
+    }
+
+    // Adds a new interval, returns its id.
+    int Add(int begin, int end)
+    {
+        ASSERT(end >= begin, "Interval end must not be less than its beginning.");
+
+        int id = Size();
+        intervals.push_back({begin, end});
+        begins.insert({begin, id});
+        ends.insert({end, id});
+
+        while (newest_candidates.size() > 0 && intervals[newest_candidates.back()].begin >= begin)
+            newest_candidates.pop_back();
+        newest_candidates.push_back(id);
+
+        if (cursor_valid)
+            UpdateCursorFor(id);
+
+        return id;
+    }
+
+    // Moves the end of an existing interval.
+    void SetEnd(int id, int end)
+    {
+        ASSERT(id >= 0 && id < Size(), "Interval id is out of range.");
+        Interval &interval = intervals[id];
+        ASSERT(end >= interval.begin, "Interval end must not be less than its beginning.");
+
+        if (interval.end == end)
+            return;
+
+        ends.erase({interval.end, id});
+        interval.end = end;
+        ends.insert({end, id});
+
+        if (cursor_valid)
+            UpdateCursorFor(id);
+    }
+
+    // Returns ids of all intervals containing `pos`, sorted by id.
+    // The returned reference remains valid until the next call to any non-const function, or to this function with a different position.
+    [[nodiscard]] const std::vector<int> &At(int pos) const
+    {
+        if (!cursor_valid)
+        {
+            cursor_valid = true;
+            cursor_pos = pos;
+            cursor_ids.clear();
+            for (int i = 0; i < Size(); i++)
+            {
+                if (Contains(i, pos))
+                    cursor_ids.push_back(i);
+            }
+            return cursor_ids;
+        }
+
+        if (pos == cursor_pos)
+            return cursor_ids;
+
+        int min = std::min(pos, cursor_pos);
+        int max = std::max(pos, cursor_pos);
+        cursor_pos = pos;
+
+        // Only the intervals with a boundary between the old and the new position could've changed.
+        UpdateCursorInRange(begins, min, max);
+        UpdateCursorInRange(ends, min, max);
+
+        return cursor_ids;
+    }
+
+    // Returns the id of the newest interval with `begin <= pos` (regardless of its end), or -1 if none.
+    [[nodiscard]] int NewestBeginningAtOrBefore(int pos) const
+    {
+        auto it = std::upper_bound(newest_candidates.begin(), newest_candidates.end(), pos, [&](int value, int id){return value < intervals[id].begin;});
+        if (it == newest_candidates.begin())
+            return -1;
+        return *std::prev(it);
+    }
+
+    // Removes all intervals.
+    void Clear()
+    {
+        intervals.clear();
+        begins.clear();
+        ends.clear();
+        newest_candidates.clear();
+        cursor_valid = false;
+        cursor_ids.clear();
+    }
+};
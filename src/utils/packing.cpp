@@ -1,13 +1,173 @@
 #include "packing.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <numeric>
+#include <utility>
 #include <vector>
 
 #include <stb_rect_pack.h>
 
 namespace Packing
 {
+    namespace
+    {
+        // A single page for the MaxRects algorithm.
+        // Tracks the list of maximal free boxes, which can overlap each other. Each rectangle is placed into the corner of one of them.
+        class MaxRectsPage
+        {
+            struct Box
+            {
+                ivec2 pos, size;
+
+                [[nodiscard]] bool Overlaps(const Box &other) const
+                {
+                    return (pos < other.pos + other.size).all() && (other.pos < pos + size).all();
+                }
+
+                [[nodiscard]] bool Contains(const Box &other) const
+                {
+                    return (pos <= other.pos).all() && (other.pos + other.size <= pos + size).all();
+                }
+            };
+
+            std::vector<Box> free_boxes;
+
+            // Lower is better.
+            [[nodiscard]] static std::pair<std::int64_t, std::int64_t> Score(Heuristic heuristic, const Box &free_box, ivec2 size)
+            {
+                ivec2 leftover = free_box.size - size;
+                std::int64_t short_side = leftover.min();
+                std::int64_t long_side = leftover.max();
+
+                switch (heuristic)
+                {
+                  case Heuristic::skyline:
+                  case Heuristic::max_rects_best_short_side:
+                    return {short_side, long_side};
+                  case Heuristic::max_rects_best_long_side:
+                    return {long_side, short_side};
+                  case Heuristic::max_rects_best_area:
+                    return {std::int64_t(free_box.size.x) * free_box.size.y - std::int64_t(size.x) * size.y, short_side};
+                  case Heuristic::max_rects_bottom_left:
+                    return {free_box.pos.y + size.y, free_box.pos.x};
+                }
+                return {};
+            }
+
+          public:
+            MaxRectsPage(ivec2 size)
+            {
+                free_boxes.push_back({ivec2(0), size});
+            }
+
+            // Marks the box as used, splitting the free boxes that overlap it.
+            void Occupy(ivec2 pos, ivec2 size)
+            {
+                Box used{pos, size};
+                ivec2 used_end = pos + size;
+
+                std::vector<Box> new_boxes;
+                new_boxes.reserve(free_boxes.size() + 4);
+                for (const Box &box : free_boxes)
+                {
+                    if (!box.Overlaps(used))
+                    {
+                        new_boxes.push_back(box);
+                        continue;
+                    }
+
+                    ivec2 box_end = box.pos + box.size;
+                    if (used.pos.x > box.pos.x)
+                        new_boxes.push_back({box.pos, ivec2(used.pos.x - box.pos.x, box.size.y)});
+                    if (used_end.x < box_end.x)
+                        new_boxes.push_back({ivec2(used_end.x, box.pos.y), ivec2(box_end.x - used_end.x, box.size.y)});
+                    if (used.pos.y > box.pos.y)
+                        new_boxes.push_back({box.pos, ivec2(box.size.x, used.pos.y - box.pos.y)});
+                    if (used_end.y < box_end.y)
+                        new_boxes.push_back({ivec2(box.pos.x, used_end.y), ivec2(box.size.x, box_end.y - used_end.y)});
+                }
+
+                // Remove the boxes that are contained in other boxes. Out of several equal boxes, only the first one is kept.
+                std::vector<bool> removed(new_boxes.size());
+                for (std::size_t i = 0; i < new_boxes.size(); i++)
+                {
+                    for (std::size_t j = 0; j < new_boxes.size(); j++)
+                    {
+                        if (i == j || removed[j] || !new_boxes[j].Contains(new_boxes[i]))
+                            continue;
+                        if (j > i && new_boxes[i].Contains(new_boxes[j]))
+                            continue; // Equal boxes, keep the first one.
+                        removed[i] = true;
+                        break;
+                    }
+                }
+
+                free_boxes.clear();
+                for (std::size_t i = 0; i < new_boxes.size(); i++)
+                {
+                    if (!removed[i])
+                        free_boxes.push_back(new_boxes[i]);
+                }
+            }
+
+            // Tries to place the rectangle, with `inner_gaps` added to its size. On success sets `pos` and `rotated`, and returns true.
+            [[nodiscard]] bool Insert(Rect &rect, int inner_gaps, Heuristic heuristic, bool allow_rotation)
+            {
+                bool found = false;
+                std::pair<std::int64_t, std::int64_t> best_score;
+                ivec2 best_pos;
+                bool best_rotated = false;
+
+                for (bool rotated : {false, true})
+                {
+                    if (rotated && (!allow_rotation || rect.size.x == rect.size.y))
+                        continue;
+
+                    ivec2 size = (rotated ? ivec2(rect.size.y, rect.size.x) : rect.size) + inner_gaps;
+                    for (const Box &box : free_boxes)
+                    {
+                        if ((size > box.size).any())
+                            continue;
+
+                        auto score = Score(heuristic, box, size);
+                        if (found && score >= best_score)
+                            continue;
+
+                        found = true;
+                        best_score = score;
+                        best_pos = box.pos;
+                        best_rotated = rotated;
+                    }
+                }
+
+                if (!found)
+                    return false;
+
+                rect.pos = best_pos;
+                rect.rotated = best_rotated;
+                Occupy(rect.pos, rect.PackedSize() + inner_gaps);
+                return true;
+            }
+        };
+
+        // Returns the order in which the MaxRects algorithm should place the rectangles: the longest side first, then the shortest side.
+        [[nodiscard]] std::vector<int> MaxRectsOrder(const Rect *data, int count)
+        {
+            std::vector<int> ret(count);
+            std::iota(ret.begin(), ret.end(), 0);
+            std::stable_sort(ret.begin(), ret.end(), [&](int a, int b)
+            {
+                ivec2 size_a = data[a].size, size_b = data[b].size;
+                if (size_a.max() != size_b.max())
+                    return size_a.max() > size_b.max();
+                return size_a.min() > size_b.min();
+            });
+            return ret;
+        }
+    }
+
     int PackRects(ivec2 target_size, Rect *data, int count, int inner_gaps, int outer_gaps)
     {
         // Adjust size.
@@ -49,4 +209,112 @@ namespace Packing
 
         return rects_not_packed;
     }
+
+    int PackRectsAround(ivec2 target_size, const Rect *occupied, int occupied_count, Rect *data, int count, int inner_gaps, int outer_gaps)
+    {
+        // Adjust size, same as in `PackRects()`.
+        MaxRectsPage page(target_size - 2 * outer_gaps + inner_gaps);
+
+        for (int i = 0; i < occupied_count; i++)
+            page.Occupy(occupied[i].pos - outer_gaps, occupied[i].PackedSize() + inner_gaps);
+
+        int rects_not_packed = 0;
+        for (int index : MaxRectsOrder(data, count))
+        {
+            Rect &rect = data[index];
+            rect.was_packed = page.Insert(rect, inner_gaps, Heuristic::max_rects_best_short_side, false);
+            if (rect.was_packed)
+                rect.pos += outer_gaps;
+            else
+                rects_not_packed++;
+        }
+
+        return rects_not_packed;
+    }
+
+    Result Pack(ivec2 page_size, Rect *data, int count, const Options &options)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            data[i].pos = ivec2(0);
+            data[i].was_packed = false;
+            data[i].rotated = false;
+            data[i].page = 0;
+        }
+
+        std::vector<int> remaining;
+        if (options.heuristic == Heuristic::skyline)
+        {
+            remaining.resize(count);
+            std::iota(remaining.begin(), remaining.end(), 0);
+        }
+        else
+        {
+            remaining = MaxRectsOrder(data, count);
+        }
+
+        Result ret;
+
+        while (!remaining.empty() && (options.max_pages < 0 || ret.pages < options.max_pages))
+        {
+            std::vector<int> not_packed;
+
+            if (options.heuristic == Heuristic::skyline)
+            {
+                std::vector<Rect> page_rects;
+                page_rects.reserve(remaining.size());
+                for (int index : remaining)
+                    page_rects.push_back(data[index].size);
+
+                PackRects(page_size, page_rects.data(), page_rects.size(), options.inner_gaps, options.outer_gaps);
+
+                for (std::size_t i = 0; i < remaining.size(); i++)
+                {
+                    Rect &rect = data[remaining[i]];
+                    rect.was_packed = page_rects[i].was_packed;
+                    if (rect.was_packed)
+                        rect.pos = page_rects[i].pos;
+                }
+            }
+            else
+            {
+                // Adjust size, same as in `PackRects()`.
+                MaxRectsPage page(page_size - 2 * options.outer_gaps + options.inner_gaps);
+
+                for (int index : remaining)
+                {
+                    Rect &rect = data[index];
+                    rect.was_packed = page.Insert(rect, options.inner_gaps, options.heuristic, options.allow_rotation);
+                    if (rect.was_packed)
+                        rect.pos += options.outer_gaps;
+                }
+            }
+
+            for (int index : remaining)
+            {
+                Rect &rect = data[index];
+                if (rect.was_packed)
+                {
+                    rect.page = ret.pages;
+                    ret.used_area += std::size_t(rect.size.prod());
+                }
+                else
+                {
+                    not_packed.push_back(index);
+                }
+            }
+
+            // If nothing fits into an empty page, then the remaining rectangles are larger than a page.
+            if (not_packed.size() == remaining.size())
+                break;
+
+            remaining = std::move(not_packed);
+            ret.pages++;
+        }
+
+        ret.rects_not_packed = remaining.size();
+        if (ret.pages > 0)
+            ret.efficiency = ret.used_area / (double(page_size.prod()) * ret.pages);
+        return ret;
+    }
 }
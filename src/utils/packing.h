@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 #include "utils/mat.h"
 
 namespace Packing
@@ -12,12 +14,54 @@ namespace Packing
         // Output:
         ivec2 pos = ivec2(0);
         bool was_packed = 0;
+        bool rotated = 0; // If true, the rectangle was rotated 90 degrees, so it occupies `size` with swapped components at `pos`. `size` itself is not changed.
+        int page = 0; // Only set by `Pack()`.
 
         Rect() {}
         Rect(ivec2 size) : size(size) {}
+
+        // The size of the area that the rectangle occupies, accounting for the rotation.
+        [[nodiscard]] ivec2 PackedSize() const
+        {
+            return rotated ? ivec2(size.y, size.x) : size;
+        }
     };
 
     // Returns 0 on success. On failure returns the amount of rectangles that didn't fit into the box.
     // Note that coordinates outside of [0;65535] range are not supported by default. This can be changed in `stb_rect_pack.h`.
     int PackRects(ivec2 target_size, Rect *data, int count, int inner_gaps = 0, int outer_gaps = 0);
+
+    // Like `PackRects()`, but places the rectangles into the free space around the `occupied` ones, which must already have their positions set.
+    // The occupied rectangles are not moved. This is useful for updating an existing atlas without repacking everything.
+    // Uses `Heuristic::max_rects_best_short_side`, without rotation.
+    int PackRectsAround(ivec2 target_size, const Rect *occupied, int occupied_count, Rect *data, int count, int inner_gaps = 0, int outer_gaps = 0);
+
+    enum class Heuristic
+    {
+        skyline, // Uses `stb_rect_pack`, same as `PackRects()`. Fast, but not the tightest. Doesn't support rotation.
+        max_rects_best_short_side, // MaxRects, minimizing the shorter leftover side of the free rectangle. Usually the tightest.
+        max_rects_best_long_side, // MaxRects, minimizing the longer leftover side of the free rectangle.
+        max_rects_best_area, // MaxRects, picking the smallest free rectangle that fits.
+        max_rects_bottom_left, // MaxRects, placing each rectangle as close to the top-left corner as possible.
+    };
+
+    struct Options
+    {
+        Heuristic heuristic = Heuristic::max_rects_best_short_side;
+        bool allow_rotation = false; // Only for the MaxRects heuristics.
+        int inner_gaps = 0;
+        int outer_gaps = 0;
+        int max_pages = 1; // When the current page is full, the remaining rectangles go to the next one. Negative means no limit.
+    };
+
+    struct Result
+    {
+        int pages = 0; // The amount of pages that have at least one rectangle.
+        int rects_not_packed = 0; // Non-zero if `max_pages` was reached, or if some rectangles are larger than a page.
+        std::size_t used_area = 0; // The total area of the packed rectangles, not counting the gaps.
+        float efficiency = 0; // `used_area` divided by the total area of all used pages.
+    };
+
+    // Packs the rectangles into one or more pages of size `page_size`. Sets `pos`, `page`, `was_packed` and `rotated` for each rectangle.
+    [[nodiscard]] Result Pack(ivec2 page_size, Rect *data, int count, const Options &options = {});
 }
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace Parallel
+{
+    // Returns the default number of threads for `ForEachIndex()`.
+    [[nodiscard]] inline int DefaultThreadCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Calls `func(std::size_t index)` for every index in `0..count-1`, spread across up to `thread_count` threads (including the calling one).
+    // Blocks until all calls are finished. The order of calls is unspecified.
+    // If any of the calls throws, the remaining indices are skipped, and the first exception is rethrown.
+    template <typename F>
+    void ForEachIndex(std::size_t count, F &&func, int thread_count = DefaultThreadCount())
+    {
+        std::size_t extra_threads = std::min(std::size_t(std::max(thread_count, 1) - 1), count > 0 ? count - 1 : 0);
+        if (extra_threads == 0)
+        {
+            for (std::size_t i = 0; i < count; i++)
+                func(i);
+            return;
+        }
+
+        std::atomic<std::size_t> next_index = 0;
+        std::mutex exception_mutex;
+        std::exception_ptr exception;
+
+        auto worker = [&]
+        {
+            try
+            {
+                std::size_t i;
+                while ((i = next_index++) < count)
+                    func(i);
+            }
+            catch (...)
+            {
+                next_index = count; // Stop the other threads.
+                std::lock_guard lock(exception_mutex);
+                if (!exception)
+                    exception = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(extra_threads);
+        for (std::size_t i = 0; i < extra_threads; i++)
+        {
+            try
+            {
+                threads.emplace_back(worker);
+            }
+            catch (const std::system_error &)
+            {
+                // Unable to start more threads. The threads already started must be joined anyway, so they and the calling thread handle the rest.
+                break;
+            }
+        }
+        worker();
+        for (std::thread &thread : threads)
+            thread.join();
+
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+}
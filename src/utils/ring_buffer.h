@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "program/errors.h"
+
+// A double-ended queue stored in a single array with a power-of-two size.
+// The array grows when full and never shrinks, so once it's large enough, pushing and popping never allocate.
+// `T` must be default-constructible. Popped elements are not destroyed until they're overwritten, so this is best used with simple types.
+template <typename T>
+class RingBuffer
+{
+  public:
+    struct ReflHelper; // Our reflection metadata uses this to access private fields.
+
+  private:
+    std::vector<T> storage; // The size is either 0 or a power of two.
+    std::size_t begin = 0;
+    std::size_t size = 0;
+
+    [[nodiscard]] std::size_t WrapIndex(std::size_t index) const
+    {
+        return index & (storage.size() - 1);
+    }
+
+    void Grow()
+    {
+        std::vector<T> new_storage(storage.empty() ? 16 : storage.size() * 2);
+        for (std::size_t i = 0; i < size; i++)
+            new_storage[i] = std::move(storage[WrapIndex(begin + i)]);
+        storage = std::move(new_storage);
+        begin = 0;
+    }
+
+  public:
+    RingBuffer() {}
+
+    [[nodiscard]] std::size_t Size() const
+    {
+        return size;
+    }
+    [[nodiscard]] bool IsEmpty() const
+    {
+        return size == 0;
+    }
+    [[nodiscard]] std::size_t Capacity() const
+    {
+        return storage.size();
+    }
+
+    // The indices start from the oldest element.
+    [[nodiscard]] T &operator[](std::size_t index)
+    {
+        ASSERT(index < size, "Ring buffer index is out of range.");
+        return storage[WrapIndex(begin + index)];
+    }
+    [[nodiscard]] const T &operator[](std::size_t index) const
+    {
+        ASSERT(index < size, "Ring buffer index is out of range.");
+        return storage[WrapIndex(begin + index)];
+    }
+
+    [[nodiscard]] T &Front() {return (*this)[0];}
+    [[nodiscard]] const T &Front() const {return (*this)[0];}
+    [[nodiscard]] T &Back() {return (*this)[size - 1];}
+    [[nodiscard]] const T &Back() const {return (*this)[size - 1];}
+
+    T &PushBack(T value)
+    {
+        if (size == storage.size())
+            Grow();
+        T &ret = storage[WrapIndex(begin + size)];
+        ret = std::move(value);
+        size++;
+        return ret;
+    }
+
+    // Removes `count` elements from the end.
+    void PopBack(std::size_t count = 1)
+    {
+        ASSERT(count <= size, "Attempt to pop too many elements from a ring buffer.");
+        size -= count;
+    }
+
+    // Removes `count` elements from the beginning.
+    void PopFront(std::size_t count = 1)
+    {
+        ASSERT(count <= size, "Attempt to pop too many elements from a ring buffer.");
+        if (count == 0)
+            return;
+        begin = WrapIndex(begin + count);
+        size -= count;
+    }
+
+    // Removes all elements. Doesn't free memory.
+    void Clear()
+    {
+        begin = 0;
+        size = 0;
+    }
+};